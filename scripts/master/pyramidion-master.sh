@@ -0,0 +1,34 @@
+#!/bin/sh
+#set -x
+
+# single master daemon: sensor/led + auto/manual switch + daily schedule
+# in gpioIrq (no service start/stop, replaces pyramidion-gpio.service +
+# pyramidion-button.service + cron.tab, the schedule is SCHEDULE only)
+
+GPIO_IN=20
+GPIO_OUT=21
+GPIO_SWITCH=16
+SCHEDULE=${SCHEDULE:-19:00-01:00}
+MQTT_SERVER=${MQTT_SERVER:-iot.eclipse.org}
+MQTT_TOPIC=pyramidion-test
+BEATLOG_DIR=${BEATLOG_DIR:-/home/pi/beatlog}
+
+# Real-time options (set in the systemd unit)
+rt_opts ()
+{
+    [ "${RT_LOCK:-0}" -ne 0 ] && echo -n "-m "
+    [ "${RT_PRIO:-0}" -gt 0 ] && echo -n "-r $RT_PRIO "
+    [ "${RT_CPU:--1}" -ge 0 ] && echo -n "-a $RT_CPU "
+}
+
+# MQTT payload: ASCII bpm (default) or binary with seq + timestamps
+# (MQTT_BINARY=1, rpi_gpio reads both)
+[ "${MQTT_BINARY:-0}" -ne 0 ] && MQTT_OPTS="-W"
+# one message per beat instead (MQTT_BEATS=1, rpi_gpio -P predicts the beats)
+[ "${MQTT_BEATS:-0}" -ne 0 ] && MQTT_OPTS="-e"
+
+# one beat log per session (beatlog_csv to export), 30 days kept
+mkdir -p $BEATLOG_DIR
+find $BEATLOG_DIR -name 'beatlog-*.bin' -mtime +30 -delete
+
+exec gpioIrq -i $GPIO_IN -o $GPIO_OUT -G $GPIO_SWITCH -S $SCHEDULE -h $MQTT_SERVER -T $MQTT_TOPIC $MQTT_OPTS -L $BEATLOG_DIR $(rt_opts)
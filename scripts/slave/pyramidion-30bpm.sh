@@ -7,6 +7,14 @@ GPIO_NR=21
 GPIO_DIR=/sys/class/gpio
 RPI_GPIO=rpi_gpio_ns
 
+# Real-time options (set in the systemd unit)
+rt_opts ()
+{
+    [ "${RT_LOCK:-0}" -ne 0 ] && echo -n "-m "
+    [ "${RT_PRIO:-0}" -gt 0 ] && echo -n "-r $RT_PRIO "
+    [ "${RT_CPU:--1}" -ge 0 ] && echo -n "-a $RT_CPU "
+}
+
 # GPIO
 gpio_off ()
 {
@@ -22,4 +30,4 @@ init_gpio ()
 }
 
 init_gpio $GPIO_NR
-$RPI_GPIO -g $GPIO_NR -p 1000000000 -q
+$RPI_GPIO -g $GPIO_NR -p 1000000000 -q $(rt_opts)
@@ -1,13 +1,23 @@
 #!/bin/sh
 #set -x
 
-MQTT_SERVER=iot.eclipse.org
+MQTT_SERVER=${MQTT_SERVER:-iot.eclipse.org}
 MQTT_TOPIC=pyramidion-test
 GPIO_NR=21
 BPM_O=30
+WAVEFORM=${WAVEFORM:-square}   # or lubdub
 
 GPIO_DIR=/sys/class/gpio
 RPI_GPIO=rpi_gpio
+CTRL_FIFO=/tmp/rpi_gpio.ctrl
+
+# Real-time options (set in the systemd unit)
+rt_opts ()
+{
+    [ "${RT_LOCK:-0}" -ne 0 ] && echo -n "-m "
+    [ "${RT_PRIO:-0}" -gt 0 ] && echo -n "-r $RT_PRIO "
+    [ "${RT_CPU:--1}" -ge 0 ] && echo -n "-a $RT_CPU "
+}
 
 
 # GPIO
@@ -52,24 +62,15 @@ init_gpio $GPIO_NR
 
 trap do_exit 2 3 15
 
-# Start with 30 bpm
+# Start with 30 bpm, rpi_gpio (built with -DUSE_MOSQUITTO) then follows
+# the BPM published on MQTT_TOPIC by itself: one persistent subscription,
+# new period applied at the next edge. The control FIFO is kept for tests
+# (echo <period-ns> > $CTRL_FIFO). Binary messages (master with
+# MQTT_BINARY=1) older than MQTT_MAX_AGE ms are dropped (clocks by NTP).
+# DMA_CHANNEL=<n>: the leds are played by DMA, not toggled by the CPU.
+# PHASE_SLEW=<%>: beats in phase with the master (binary messages, NTP).
+[ -p $CTRL_FIFO ] || mkfifo $CTRL_FIFO
 PERIOD=$(get_period_value $BPM_O)
-$RPI_GPIO -g $GPIO_NR -p ${PERIOD}000000 -q &
-
-while [ 1 ]
-do
-    BPM=$(mosquitto_sub -C 1 -h $MQTT_SERVER -t $MQTT_TOPIC)
-    PERIOD=$(get_period_value $BPM)
-    
-    echo "received BPM is $BPM pulse/mn, period is $PERIOD ms"
-
-    # if new value then kill program
-    if [ $BPM -ne $BPM_O ]; then
-	kill_program
-
-	echo "starting $RPI_GPIO"
-	$RPI_GPIO -g $GPIO_NR -p ${PERIOD}000000 -q &
-    fi	
+$RPI_GPIO -g $GPIO_NR -p ${PERIOD}000000 -c $CTRL_FIFO -h $MQTT_SERVER -T $MQTT_TOPIC ${MQTT_MAX_AGE:+-A $MQTT_MAX_AGE} -s $WAVEFORM ${DMA_CHANNEL:+-D $DMA_CHANNEL} ${PHASE_SLEW:+-P $PHASE_SLEW} -q $(rt_opts) &
 
-    BPM_O=$BPM
-done
+wait
@@ -0,0 +1,71 @@
+#!/bin/sh
+#
+# Master restart test on one host, through a local broker: this script
+# plays the master (binary bpm messages, see src/GPIO/common/wire.h),
+# rpi_gpio is the slave on fake registers. The "master" sends a run of
+# messages, then restarts: new session, seq back to 1, another bpm. The
+# slave must apply the first message of the new session (exit 1 if
+# not). Needs mosquitto + mosquitto_pub and rpi_gpio / pyramidion_stat
+# built with -DUSE_MOSQUITTO.
+#
+#set -x
+
+TOPIC=pyramidion-restart
+RPI_GPIO=${RPI_GPIO:-rpi_gpio}
+STAT=${STAT:-pyramidion_stat}
+MSG=/tmp/pyramidion-restart.bin
+
+# <value> <bytes>: little endian
+le ()
+{
+    v=$1
+    i=0
+    while [ $i -lt $2 ]; do
+	printf "\\$(printf %03o $((v & 255)))"
+	v=$((v >> 8))
+	i=$((i + 1))
+    done
+}
+
+# <session> <seq> <bpm>: magic, version 3, channel 0, no flags
+wire_msg ()
+{
+    now=$(date +%s%N)
+    {
+	printf '\267\003\000\000'
+	le $2 4; le $(($3 * 1000)) 4; le 0 4
+	le $now 8; le $now 8; le 0 8
+	le $1 4
+    } > $MSG
+    mosquitto_pub -h localhost -t $TOPIC -f $MSG
+}
+
+# half period applied by the slave (ns)
+period ()
+{
+    $STAT -j -1 rpi_gpio | sed -n 's/.*"period_ns": \([0-9]*\).*/\1/p'
+}
+
+pgrep -x mosquitto > /dev/null || mosquitto -d
+
+$RPI_GPIO -F -q -h localhost -T $TOPIC &
+SLAVE=$!
+sleep 1
+
+# first master: seq 100.. so that seq 1 looks late without the session
+for seq in 100 101 102 103 104; do
+    wire_msg 1111 $seq 60
+    sleep 0.2
+done
+
+# restarted master
+wire_msg 2222 1 90
+sleep 1
+
+P=$(period)
+kill $SLAVE
+rm -f $MSG
+
+echo "period after the restart: $P ns (90 bpm: 333333333)"
+[ "$P" = 333333333 ] || { echo "FAILED: new session not applied"; exit 1; }
+echo OK
@@ -0,0 +1,84 @@
+#!/bin/sh
+#
+# Phase sync test on one host, through a local broker: this script plays
+# the master (binary bpm messages with a reference beat, see
+# src/GPIO/common/wire.h), rpi_gpio -P is the slave on fake registers.
+# The slave is killed and restarted half way: it must get back on the
+# grid at its first message, then stay within MAX_ERR_NS of it (last
+# beat and p99 of the beats since, exit 1 if not). Needs mosquitto +
+# mosquitto_pub and rpi_gpio / pyramidion_stat built with -DUSE_MOSQUITTO.
+#
+#set -x
+
+TOPIC=pyramidion-sync
+BPM=${BPM:-72}
+SLEW=${SLEW:-5}
+MAX_ERR_NS=${MAX_ERR_NS:-1000000}   # 1 ms
+RPI_GPIO=${RPI_GPIO:-rpi_gpio}
+STAT=${STAT:-pyramidion_stat}
+MSG=/tmp/pyramidion-sync.bin
+
+# <value> <bytes>: little endian
+le ()
+{
+    v=$1
+    i=0
+    while [ $i -lt $2 ]; do
+	printf "\\$(printf %03o $((v & 255)))"
+	v=$((v >> 8))
+	i=$((i + 1))
+    done
+}
+
+# <seq> <bpm> <beat-ns>: magic, version 1, channel 0, WIRE_F_BEAT
+wire_msg ()
+{
+    now=$(date +%s%N)
+    {
+	printf '\267\001\000\001'
+	le $1 4; le $(($2 * 1000)) 4; le 0 4
+	le $now 8; le $now 8; le $3 8
+    } > $MSG
+}
+
+# <field> of the rpi_gpio align_ns JSON object
+align ()
+{
+    echo "$ALIGN" | sed -n "s/.*\"align_ns\": {.*\"$1\": \(-*[0-9]*\).*/\1/p"
+}
+
+slave ()
+{
+    $RPI_GPIO -F -q -P $SLEW -h localhost -T $TOPIC &
+    SLAVE=$!
+}
+
+pgrep -x mosquitto > /dev/null || mosquitto -d
+
+# master grid: a beat on the second boundary, every 60/BPM s
+EPOCH=$(( $(date +%s%N) / 1000000000 * 1000000000 ))
+wire_msg 1 $BPM $EPOCH
+
+slave
+for n in 1 2 3 4 5 6 7 8 9 10; do
+    mosquitto_pub -h localhost -t $TOPIC -f $MSG
+    [ $n -eq 5 ] && { kill $SLAVE; wait $SLAVE; slave; }
+    sleep 1
+done
+
+$STAT -1 rpi_gpio
+ALIGN=$($STAT -j -1 rpi_gpio)
+kill $SLAVE
+rm -f $MSG
+
+LAST=$(align last); P99=$(align p99); SAMPLES=$(align samples)
+echo "align: last= $LAST ns p99= $P99 ns ($SAMPLES beats), limit $MAX_ERR_NS ns"
+if [ -z "$SAMPLES" ] || [ "$SAMPLES" -lt 3 ]; then
+    echo "FAILED: not locked on the grid"
+    exit 1
+fi
+if [ ${LAST#-} -gt $MAX_ERR_NS ] || [ $P99 -gt $MAX_ERR_NS ]; then
+    echo "FAILED: phase error over the limit"
+    exit 1
+fi
+echo OK
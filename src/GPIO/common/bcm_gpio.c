@@ -0,0 +1,94 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "bcm_gpio.h"
+
+#define DT_RANGES "/proc/device-tree/soc/ranges"
+
+volatile uint32_t *bcm_gpio = NULL;
+int bcm_gpio_fake = 0;
+
+static uint32_t be32(unsigned char *p)
+{
+  return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+/****************************************************************
+ * bcm_peri_base
+ *
+ * soc/ranges = <child-addr parent-addr size>, parent-addr is the
+ * peripheral base (one cell on Pi 1-3, two on Pi 4, high word 0).
+ ****************************************************************/
+
+unsigned long bcm_peri_base(void)
+{
+  unsigned char buf[12];
+  unsigned long base = 0;
+  FILE *f;
+
+  if ((f = fopen(DT_RANGES, "rb")) != NULL) {
+    if (fread(buf, 1, sizeof(buf), f) >= 8) {
+      base = be32(buf + 4);
+      if (base == 0)
+	base = be32(buf + 8);
+    }
+    fclose(f);
+  }
+
+  if (base == 0) {
+    fprintf(stderr, "bcm_gpio: no %s, using 0x%08x\n", DT_RANGES, BCM_PERI_BASE_DEFAULT);
+    base = BCM_PERI_BASE_DEFAULT;
+  }
+
+  return base;
+}
+
+/****************************************************************
+ * bcm_gpio_open
+ ****************************************************************/
+
+int bcm_gpio_open(int backend)
+{
+  void *map;
+  int fd;
+
+  if (bcm_gpio)
+    return 0;
+
+  if (backend == BCM_GPIO_FAKE) {
+    if ((map = calloc(1, BCM_GPIO_SIZE)) == NULL) {
+      perror("bcm_gpio/calloc");
+      return -1;
+    }
+    bcm_gpio_fake = 1;
+    bcm_gpio = map;
+    return 0;
+  }
+
+  // /dev/gpiomem maps the GPIO block at offset 0
+  if ((fd = open("/dev/gpiomem", O_RDWR | O_SYNC | O_CLOEXEC)) >= 0) {
+    map = mmap(NULL, BCM_GPIO_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  else if ((fd = open("/dev/mem", O_RDWR | O_SYNC | O_CLOEXEC)) >= 0) {
+    map = mmap(NULL, BCM_GPIO_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, bcm_peri_base() + BCM_GPIO_OFFSET);
+  }
+  else {
+    perror("bcm_gpio/open /dev/gpiomem, /dev/mem");
+    return -1;
+  }
+
+  close(fd); // No need to keep fd open after mmap
+
+  if (map == MAP_FAILED) {
+    perror("bcm_gpio/mmap");
+    return -1;
+  }
+
+  bcm_gpio = map;
+
+  return 0;
+}
@@ -0,0 +1,97 @@
+#ifndef BCM_GPIO_H
+#define BCM_GPIO_H
+
+#include <stdint.h>
+
+/****************************************************************
+ * BCM283x/2711 GPIO registers, mmap()ed once (rpi_gpio, gpioIrq)
+ *
+ * /dev/gpiomem first (GPIO block only, no root needed), else /dev/mem
+ * at the peripheral base read from the device tree (Pi 1/2/3/4).
+ * The fake backend maps plain memory and mirrors GPSET/GPCLR into
+ * GPLEV, so the same code runs on x86.
+ *
+ * After bcm_gpio_open() a pin change is a single store, no syscall.
+ ****************************************************************/
+
+#define BCM_PERI_BASE_PI1  0x20000000
+#define BCM_PERI_BASE_PI2  0x3F000000   /* Pi 2 & 3 */
+#define BCM_PERI_BASE_PI4  0xFE000000
+#define BCM_PERI_BASE_DEFAULT BCM_PERI_BASE_PI2
+
+#define BCM_GPIO_OFFSET    0x200000     /* GPIO block in the peripherals */
+#define BCM_GPIO_SIZE      (4*1024)
+
+/* register indexes (32 bit words) */
+#define BCM_GPFSEL0  0
+#define BCM_GPSET0   7
+#define BCM_GPCLR0   10
+#define BCM_GPLEV0   13
+
+/* backends */
+#define BCM_GPIO_HW    0
+#define BCM_GPIO_FAKE  1
+
+#if defined(__arm__) || defined(__aarch64__)
+#define BCM_GPIO_BACKEND_DEFAULT BCM_GPIO_HW
+#else
+#define BCM_GPIO_BACKEND_DEFAULT BCM_GPIO_FAKE
+#endif
+
+extern volatile uint32_t *bcm_gpio;   /* NULL until bcm_gpio_open() */
+extern int bcm_gpio_fake;
+
+int bcm_gpio_open(int backend);
+unsigned long bcm_peri_base(void);
+
+/* function select: input or output */
+static inline void bcm_gpio_in(int g)
+{
+  bcm_gpio[BCM_GPFSEL0 + g / 10] &= ~(7 << ((g % 10) * 3));
+}
+
+static inline void bcm_gpio_out(int g)
+{
+  bcm_gpio_in(g);
+  bcm_gpio[BCM_GPFSEL0 + g / 10] |= (1 << ((g % 10) * 3));
+}
+
+static inline void bcm_gpio_set(int g)
+{
+  bcm_gpio[BCM_GPSET0 + g / 32] = 1U << (g % 32);
+  if (bcm_gpio_fake)
+    bcm_gpio[BCM_GPLEV0 + g / 32] |= 1U << (g % 32);
+}
+
+static inline void bcm_gpio_clr(int g)
+{
+  bcm_gpio[BCM_GPCLR0 + g / 32] = 1U << (g % 32);
+  if (bcm_gpio_fake)
+    bcm_gpio[BCM_GPLEV0 + g / 32] &= ~(1U << (g % 32));
+}
+
+static inline void bcm_gpio_write(int g, unsigned int value)
+{
+  if (value)
+    bcm_gpio_set(g);
+  else
+    bcm_gpio_clr(g);
+}
+
+/* several pins of one bank (0: GPIO 0-31, 1: 32-53) in one store each */
+static inline void bcm_gpio_write_mask(int bank, uint32_t set, uint32_t clr)
+{
+  if (set)
+    bcm_gpio[BCM_GPSET0 + bank] = set;
+  if (clr)
+    bcm_gpio[BCM_GPCLR0 + bank] = clr;
+  if (bcm_gpio_fake)
+    bcm_gpio[BCM_GPLEV0 + bank] = (bcm_gpio[BCM_GPLEV0 + bank] | set) & ~clr;
+}
+
+static inline unsigned int bcm_gpio_read(int g)
+{
+  return (bcm_gpio[BCM_GPLEV0 + g / 32] >> (g % 32)) & 1;
+}
+
+#endif /* BCM_GPIO_H */
@@ -0,0 +1,163 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "hist.h"
+
+#define LOAD(p)     __atomic_load_n(p, __ATOMIC_RELAXED)
+#define STORE(p, v) __atomic_store_n(p, v, __ATOMIC_RELAXED)
+
+/****************************************************************
+ * hist_bucket
+ ****************************************************************/
+
+static inline int hist_bucket(uint64_t v)
+{
+  int e;
+
+  if (v < HIST_SUB)
+    return v;
+
+  e = 63 - __builtin_clzll(v);
+
+  return ((e - HIST_SUB_BITS + 1) << HIST_SUB_BITS) | ((v >> (e - HIST_SUB_BITS)) & (HIST_SUB - 1));
+}
+
+uint64_t hist_bucket_low(int i)
+{
+  int e = (i >> HIST_SUB_BITS) + HIST_SUB_BITS - 1;
+
+  if (i < HIST_SUB)
+    return i;
+
+  return (uint64_t)(HIST_SUB | (i & (HIST_SUB - 1))) << (e - HIST_SUB_BITS);
+}
+
+uint64_t hist_bucket_high(int i)
+{
+  if (i + 1 >= HIST_BUCKETS)
+    return UINT64_MAX;
+
+  return hist_bucket_low(i + 1) - 1;
+}
+
+/****************************************************************
+ * hist_add / hist_missed (single writer)
+ ****************************************************************/
+
+void hist_add(struct hist *h, uint64_t v)
+{
+  int i = hist_bucket(v);
+
+  STORE(&h->count[i], LOAD(&h->count[i]) + 1);
+  STORE(&h->samples, LOAD(&h->samples) + 1);
+  if (v > LOAD(&h->max))
+    STORE(&h->max, v);
+}
+
+void hist_missed(struct hist *h, uint64_t n)
+{
+  STORE(&h->missed, LOAD(&h->missed) + n);
+}
+
+/****************************************************************
+ * hist_snapshot
+ ****************************************************************/
+
+void hist_snapshot(struct hist *h, struct hist *snap)
+{
+  int i;
+
+  snap->samples = 0;
+  for (i = 0 ; i < HIST_BUCKETS ; i++) {
+    snap->count[i] = LOAD(&h->count[i]);
+    snap->samples += snap->count[i];
+  }
+  snap->max = LOAD(&h->max);
+  snap->missed = LOAD(&h->missed);
+}
+
+/****************************************************************
+ * hist_percentile (upper bound of the bucket, capped to max)
+ ****************************************************************/
+
+uint64_t hist_percentile(struct hist *snap, double p)
+{
+  uint64_t rank, n = 0;
+  int i;
+
+  if (!snap->samples)
+    return 0;
+
+  rank = (uint64_t)(p / 100.0 * snap->samples);
+  if (rank >= snap->samples)
+    rank = snap->samples - 1;
+
+  for (i = 0 ; i < HIST_BUCKETS ; i++) {
+    n += snap->count[i];
+    if (n > rank)
+      break;
+  }
+
+  if (i == HIST_BUCKETS || hist_bucket_high(i) > snap->max)
+    return snap->max;
+
+  return hist_bucket_high(i);
+}
+
+/****************************************************************
+ * hist_print
+ ****************************************************************/
+
+void hist_print(FILE *f, struct hist *snap, int fmt)
+{
+  uint64_t p50 = hist_percentile(snap, 50), p99 = hist_percentile(snap, 99), p999 = hist_percentile(snap, 99.9);
+  int i, first = 1;
+
+  switch (fmt) {
+  case HIST_FMT_CSV:
+    fprintf(f, "# samples=%llu missed=%llu p50=%llu p99=%llu p99.9=%llu max=%llu\n",
+	    (unsigned long long)snap->samples, (unsigned long long)snap->missed,
+	    (unsigned long long)p50, (unsigned long long)p99, (unsigned long long)p999, (unsigned long long)snap->max);
+    fprintf(f, "low,high,count\n");
+    for (i = 0 ; i < HIST_BUCKETS ; i++)
+      if (snap->count[i])
+	fprintf(f, "%llu,%llu,%llu\n", (unsigned long long)hist_bucket_low(i),
+		(unsigned long long)hist_bucket_high(i), (unsigned long long)snap->count[i]);
+    break;
+
+  case HIST_FMT_JSON:
+    fprintf(f, "{\"samples\": %llu, \"missed\": %llu, \"p50\": %llu, \"p99\": %llu, \"p99.9\": %llu, \"max\": %llu, \"buckets\": [",
+	    (unsigned long long)snap->samples, (unsigned long long)snap->missed,
+	    (unsigned long long)p50, (unsigned long long)p99, (unsigned long long)p999, (unsigned long long)snap->max);
+    for (i = 0 ; i < HIST_BUCKETS ; i++)
+      if (snap->count[i]) {
+	fprintf(f, "%s[%llu, %llu, %llu]", first ? "" : ", ", (unsigned long long)hist_bucket_low(i),
+		(unsigned long long)hist_bucket_high(i), (unsigned long long)snap->count[i]);
+	first = 0;
+      }
+    fprintf(f, "]}\n");
+    break;
+
+  default:
+    fprintf(f, "samples= %llu missed= %llu p50= %llu p99= %llu p99.9= %llu max= %llu\n",
+	    (unsigned long long)snap->samples, (unsigned long long)snap->missed,
+	    (unsigned long long)p50, (unsigned long long)p99, (unsigned long long)p999, (unsigned long long)snap->max);
+    break;
+  }
+}
+
+/****************************************************************
+ * hist_fmt (format from file extension)
+ ****************************************************************/
+
+int hist_fmt(char *filename)
+{
+  char *ext = strrchr(filename, '.');
+
+  if (ext && !strcmp(ext, ".csv"))
+    return HIST_FMT_CSV;
+  if (ext && !strcmp(ext, ".json"))
+    return HIST_FMT_JSON;
+
+  return HIST_FMT_TEXT;
+}
@@ -0,0 +1,45 @@
+#ifndef HIST_H
+#define HIST_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/****************************************************************
+ * Log-bucketed latency histogram
+ *
+ * One writer (hot path) and any number of readers, no lock: the
+ * writer only does relaxed atomic stores, readers see a slightly
+ * stale but consistent enough view.
+ *
+ * Values < 2^HIST_SUB_BITS get their own bucket, above that each
+ * power of 2 is split in 2^HIST_SUB_BITS buckets (12.5% resolution).
+ ****************************************************************/
+
+#define HIST_SUB_BITS 3
+#define HIST_SUB      (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS  ((64 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+#define HIST_FMT_TEXT 0
+#define HIST_FMT_CSV  1
+#define HIST_FMT_JSON 2
+
+struct hist {
+  uint64_t count[HIST_BUCKETS];
+  uint64_t samples;
+  uint64_t max;
+  uint64_t missed;   /* events that produced no sample (missed periods...) */
+};
+
+/* writer */
+void hist_add(struct hist *h, uint64_t v);
+void hist_missed(struct hist *h, uint64_t n);
+
+/* readers */
+void hist_snapshot(struct hist *h, struct hist *snap);
+uint64_t hist_percentile(struct hist *snap, double p);
+uint64_t hist_bucket_low(int i);
+uint64_t hist_bucket_high(int i);
+void hist_print(FILE *f, struct hist *snap, int fmt);
+int hist_fmt(char *filename);
+
+#endif /* HIST_H */
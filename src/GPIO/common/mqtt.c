@@ -0,0 +1,499 @@
+#ifdef USE_MOSQUITTO
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "mqtt.h"
+
+struct mosquitto *mosq = NULL;
+char *mqtt_host = NULL;
+char *mqtt_topic = NULL;
+int mqtt_heartbeat = 0;
+char *mqtt_batch_topic = NULL;
+int mqtt_wire = MQTT_WIRE_ASCII;
+
+static mqtt_msg_cb_t mqtt_msg_cb = NULL;
+
+/* outbound queue, one slot per topic */
+struct mqtt_slot {
+  char *topic;
+  char msg[MQTT_MSG_MAX];        /* latest value */
+  char sent[MQTT_MSG_MAX];       /* last published value */
+  int len, sent_len;             /* -1 -> nothing sent */
+  int raw;                       /* binary, never batched */
+  long long ts_sent;             /* ms */
+  unsigned long order;           /* of the latest value */
+};
+
+/* beat events (mqtt_send_beat()): never coalesced, the oldest one goes
+   when full. head / tail only grow, the entry is [i % MQTT_EVENTS_MAX] */
+struct mqtt_event {
+  char *topic;
+  uint8_t msg[WIRE_SIZE];
+  int len;
+  unsigned long order;
+};
+
+/* mqtt_send_bpm() state per channel */
+#define MQTT_WIRE_CHANNELS 256
+
+struct mqtt_wire_tx {
+  uint32_t seq;        /* last one sent, bpm messages and beat events */
+  uint32_t bpm_seq;    /* of the last bpm message, 0 -> none */
+  int bpm;             /* of the last bpm message */
+  int64_t beat;        /* CLOCK_MONOTONIC of its beat, 0 -> none */
+};
+
+static struct mqtt_wire_tx mqtt_wire_tx[MQTT_WIRE_CHANNELS];
+static uint32_t mqtt_session;   /* wire session of this process */
+
+static struct mqtt_slot mqtt_queue[MQTT_QUEUE_MAX];
+static int mqtt_nslots;
+static struct mqtt_event mqtt_events[MQTT_EVENTS_MAX];
+static unsigned long mqtt_ev_head, mqtt_ev_tail;
+static unsigned long mqtt_order;   /* enqueue order, slots and events */
+static pthread_mutex_t mqtt_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t mqtt_thread;
+
+/* link state, written by the MQTT thread */
+static int mqtt_connected;
+static int mqtt_resync;
+static int mqtt_delay = MQTT_RECONNECT_MIN;   /* sec */
+
+static long long mqtt_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void *mqtt_loop(void *arg);
+
+void mosq_log_callback(struct mosquitto *mosq, void *userdata, int level, const char *str)
+{
+  /* Pring all log messages regardless of level. */
+  
+  switch(level){
+    //case MOSQ_LOG_DEBUG:
+    //case MOSQ_LOG_INFO:
+    //case MOSQ_LOG_NOTICE:
+  case MOSQ_LOG_WARNING:
+  case MOSQ_LOG_ERR: {
+    printf("%i:%s\n", level, str);
+  }
+  }
+}
+
+/* (re)subscribe and replay the queue on each connection */
+void mosq_connect_callback(struct mosquitto *mosq, void *userdata, int rc)
+{
+  if (rc != 0)
+    return;
+
+  fprintf(stderr, "mqtt: connected to %s\n", mqtt_host);
+  mqtt_delay = MQTT_RECONNECT_MIN;
+  mqtt_resync = 1;
+  __atomic_store_n(&mqtt_connected, 1, __ATOMIC_RELEASE);
+
+  if (mqtt_msg_cb && mqtt_topic)
+    mosquitto_subscribe(mosq, NULL, mqtt_topic, 0);
+}
+
+/* from mosquitto_loop(), before it returns the error: rc 0 -> asked for */
+void mosq_disconnect_callback(struct mosquitto *mosq, void *userdata, int rc)
+{
+  if (__atomic_exchange_n(&mqtt_connected, 0, __ATOMIC_ACQ_REL) && rc != 0)
+    fprintf(stderr, "mqtt: connection lost (%d)\n", rc);
+}
+
+void mosq_message_callback(struct mosquitto *mosq, void *userdata, const struct mosquitto_message *msg)
+{
+  if (mqtt_msg_cb && msg->payloadlen > 0)
+    mqtt_msg_cb(msg->payload, msg->payloadlen);
+}
+
+/* set before mqtt_setup() */
+void mqtt_subscribe(mqtt_msg_cb_t cb)
+{
+  mqtt_msg_cb = cb;
+}
+
+void mqtt_setup()
+{
+  bool clean_session = true;
+
+  mqtt_session = wire_session_new();
+
+  if (!mqtt_host) 
+    return;
+  
+  mosquitto_lib_init();
+  mosq = mosquitto_new(NULL, clean_session, NULL);
+  if(!mosq){
+    fprintf(stderr, "Error: Out of memory.\n");
+    mqtt_host = 0;
+    return;
+    //    exit(1);
+  }
+  
+  mosquitto_log_callback_set(mosq, mosq_log_callback);
+  mosquitto_connect_callback_set(mosq, mosq_connect_callback);
+  mosquitto_disconnect_callback_set(mosq, mosq_disconnect_callback);
+  mosquitto_message_callback_set(mosq, mosq_message_callback);
+  
+  /* no wait for the broker: if it is down the MQTT thread retries */
+  if(mosquitto_connect_async(mosq, mqtt_host, MQTT_PORT, MQTT_KEEPALIVE))
+    fprintf(stderr, "mqtt: unable to connect to %s, will retry\n", mqtt_host);
+
+  /* our own loop thread (instead of mosquitto_loop_start) drains the queue */
+  mosquitto_threaded_set(mosq, true);
+
+  int loop = pthread_create(&mqtt_thread, NULL, mqtt_loop, NULL);
+
+  if(loop != 0){
+    fprintf(stderr, "Unable to start loop: %i\n", loop);
+    mqtt_host = 0;
+    return;
+    //    exit(1);
+  }
+}
+
+/* publish failed, retry the slot on the next flush */
+static void mqtt_unsent(int i)
+{
+  pthread_mutex_lock(&mqtt_lock);
+  mqtt_queue[i].sent_len = -1;
+  pthread_mutex_unlock(&mqtt_lock);
+}
+
+/****************************************************************
+ * mqtt_flush
+ *
+ * Publish the changed slots (all of them if force or heartbeat due)
+ * and the queued beat events, in the order they were queued (the seq
+ * order of each channel). Messages are copied under the lock and
+ * published outside of it so that mqtt_send*() never waits on the
+ * network.
+ *
+ * While the link is down nothing is marked as sent: the slots keep
+ * the latest value per topic and are all replayed on reconnection,
+ * the events wait in their queue (the last MQTT_EVENTS_MAX of them).
+ *
+ * Binary (wire) slots are always published on their own topic.
+ ****************************************************************/
+
+void mqtt_flush(int force)
+{
+  char out[MQTT_QUEUE_MAX][MQTT_MSG_MAX];
+  char *topic[MQTT_QUEUE_MAX];
+  int slot[MQTT_QUEUE_MAX], out_len[MQTT_QUEUE_MAX], raw[MQTT_QUEUE_MAX];
+  unsigned long order[MQTT_QUEUE_MAX];
+  struct mqtt_event ev[MQTT_EVENTS_MAX];
+  char batch[MQTT_QUEUE_MAX * (MQTT_MSG_MAX + 64)];
+  long long now = mqtt_now();
+  unsigned long tail;
+  struct mqtt_slot *s;
+  int i, j, k, n = 0, nb = 0, ne = 0, len = 0, rc;
+
+  if (!mqtt_host || !__atomic_load_n(&mqtt_connected, __ATOMIC_ACQUIRE))
+    return;
+
+  if (mqtt_resync) {
+    mqtt_resync = 0;
+    force = 1;
+  }
+
+  pthread_mutex_lock(&mqtt_lock);
+  for (i = 0 ; i < mqtt_nslots ; i++) {
+    s = &mqtt_queue[i];
+    if (!force && s->len == s->sent_len && !memcmp(s->msg, s->sent, s->len) &&
+	!(mqtt_heartbeat > 0 && now - s->ts_sent >= mqtt_heartbeat))
+      continue;
+
+    memcpy(s->sent, s->msg, s->len);
+    s->sent_len = s->len;
+    s->ts_sent = now;
+
+    // by order: insertion sort, a few slots at most
+    for (j = n ; j > 0 && order[j - 1] > s->order ; j--) {
+      memcpy(out[j], out[j - 1], out_len[j - 1]);
+      out_len[j] = out_len[j - 1];
+      raw[j] = raw[j - 1];
+      slot[j] = slot[j - 1];
+      topic[j] = topic[j - 1];
+      order[j] = order[j - 1];
+    }
+    memcpy(out[j], s->msg, s->len);
+    out_len[j] = s->len;
+    raw[j] = s->raw;
+    nb += !s->raw;
+    slot[j] = i;
+    topic[j] = s->topic;
+    order[j] = s->order;
+    n++;
+  }
+  tail = mqtt_ev_tail;
+  for (ne = 0 ; tail + ne != mqtt_ev_head ; ne++)
+    ev[ne] = mqtt_events[(tail + ne) % MQTT_EVENTS_MAX];
+  pthread_mutex_unlock(&mqtt_lock);
+
+  if (mqtt_batch_topic && nb > 1) {
+    for (i = 0 ; i < n && len < (int)sizeof(batch) ; i++)
+      if (!raw[i])
+	len += snprintf(batch + len, sizeof(batch) - len, "%s %.*s\n", topic[i], out_len[i], out[i]);
+    if (len > (int)sizeof(batch) - 1)
+      len = sizeof(batch) - 1;
+    rc = mosquitto_publish(mosq, NULL, mqtt_batch_topic, len, batch, 0, 0);
+    for (i = 0 ; rc != MOSQ_ERR_SUCCESS && i < n ; i++)
+      if (!raw[i])
+	mqtt_unsent(slot[i]);
+  }
+
+  // slots and events merged by order, an event not published stays queued
+  for (i = 0, k = 0 ; i < n || k < ne ; ) {
+    if (k < ne && (i == n || ev[k].order < order[i])) {
+      rc = mosquitto_publish(mosq, NULL, ev[k].topic, ev[k].len, ev[k].msg, 0, 0);
+      if (rc != MOSQ_ERR_SUCCESS)
+	ne = k;
+      else
+	k++;
+      continue;
+    }
+    if (!(mqtt_batch_topic && nb > 1 && !raw[i])) {
+      rc = mosquitto_publish(mosq, NULL, topic[i], out_len[i], out[i], 0, 0);
+      if (rc != MOSQ_ERR_SUCCESS)
+	mqtt_unsent(slot[i]);
+    }
+    i++;
+  }
+
+  // the queue may have dropped some of them meanwhile (full)
+  pthread_mutex_lock(&mqtt_lock);
+  if ((long)(mqtt_ev_tail - (tail + k)) < 0)
+    mqtt_ev_tail = tail + k;
+  pthread_mutex_unlock(&mqtt_lock);
+}
+
+/****************************************************************
+ * mqtt_loop (MQTT thread: network + queue drain)
+ *
+ * Link down -> non blocking reconnect with exponential backoff
+ * (MQTT_RECONNECT_MIN..MQTT_RECONNECT_MAX sec), mqtt_send*() callers
+ * never see it.
+ ****************************************************************/
+
+static void *mqtt_loop(void *arg)
+{
+  long long next = 0, retry = 0, now;
+  int rc;
+
+  while (1) {
+    rc = mosquitto_loop(mosq, MQTT_FLUSH_MS, 1);
+    if (rc != MOSQ_ERR_SUCCESS) {
+      __atomic_store_n(&mqtt_connected, 0, __ATOMIC_RELEASE);
+
+      now = mqtt_now();
+      if (now >= retry) {
+	mosquitto_reconnect_async(mosq);
+	retry = now + mqtt_delay * 1000LL;
+	if ((mqtt_delay *= 2) > MQTT_RECONNECT_MAX)
+	  mqtt_delay = MQTT_RECONNECT_MAX;
+      }
+
+      /* no socket -> mosquitto_loop() returns at once */
+      usleep(MQTT_FLUSH_MS * 1000);
+      continue;
+    }
+
+    now = mqtt_now();
+    if (now >= next) {
+      mqtt_flush(0);
+      next = now + MQTT_FLUSH_MS;
+    }
+  }
+
+  return NULL;
+}
+
+/* queue msg (len bytes) for topic (latest wins), published by the MQTT
+   thread. topic is kept by pointer and must stay valid. */
+static int mqtt_enqueue(char *topic, const void *msg, int len, int raw)
+{
+  struct mqtt_slot *s = NULL;
+  int i, rc = MOSQ_ERR_SUCCESS;
+
+  if (!mqtt_host || !topic) 
+    return 0;
+
+  pthread_mutex_lock(&mqtt_lock);
+  for (i = 0 ; i < mqtt_nslots ; i++) {
+    if (!strcmp(mqtt_queue[i].topic, topic)) {
+      s = &mqtt_queue[i];
+      break;
+    }
+  }
+
+  if (!s && mqtt_nslots < MQTT_QUEUE_MAX) {
+    s = &mqtt_queue[mqtt_nslots++];
+    s->topic = topic;
+    s->sent_len = -1;
+    s->ts_sent = 0;
+  }
+
+  if (s) {
+    if (len > MQTT_MSG_MAX)
+      len = MQTT_MSG_MAX;
+    memcpy(s->msg, msg, len);
+    s->len = len;
+    s->raw = raw;
+    s->order = ++mqtt_order;
+  }
+  else
+    rc = MOSQ_ERR_NOMEM;
+  pthread_mutex_unlock(&mqtt_lock);
+
+  return rc;
+}
+
+/* queue a beat event (binary, len <= WIRE_SIZE) for topic, after the
+   ones already queued */
+static int mqtt_enqueue_event(char *topic, const void *msg, int len)
+{
+  struct mqtt_event *e;
+
+  if (!mqtt_host || !topic)
+    return 0;
+
+  pthread_mutex_lock(&mqtt_lock);
+  if (mqtt_ev_head - mqtt_ev_tail == MQTT_EVENTS_MAX)
+    mqtt_ev_tail++;   /* full: the receiver sees a seq gap */
+  e = &mqtt_events[mqtt_ev_head++ % MQTT_EVENTS_MAX];
+  e->topic = topic;
+  memcpy(e->msg, msg, len);
+  e->len = len;
+  e->order = ++mqtt_order;
+  pthread_mutex_unlock(&mqtt_lock);
+
+  return MOSQ_ERR_SUCCESS;
+}
+
+int mqtt_send_topic(char *topic, char *msg)
+{
+  return mqtt_enqueue(topic, msg, strlen(msg), 0);
+}
+
+int mqtt_send_raw(char *topic, const void *msg, int len)
+{
+  return mqtt_enqueue(topic, msg, len, 1);
+}
+
+/****************************************************************
+ * mqtt_send_bpm
+ *
+ * Queue a bpm for topic in the mqtt_wire format. Binary: a new value
+ * gets the next seq of the channel and the send timestamps, the same
+ * value is not re-encoded (so it stays "unchanged" for the queue and
+ * the heartbeat replays it with its seq) unless beat events went out
+ * since (mqtt_send_beat(), same seq). beat_ns: CLOCK_MONOTONIC
+ * of the last beat, 0 if none; it is re-sent when it moved off the
+ * beat grid of the last message (phase reference, see wire.h).
+ ****************************************************************/
+
+static int mqtt_phase_moved(struct mqtt_wire_tx *tx, int bpm, int64_t beat_ns)
+{
+  int64_t cycle, d;
+
+  if (!beat_ns || bpm <= 0)
+    return 0;
+  if (!tx->beat)
+    return 1;
+
+  cycle = 60000000000LL / bpm;
+  d = (beat_ns - tx->beat) % cycle;
+  if (d < 0)
+    d += cycle;
+
+  return d > WIRE_PHASE_RESYNC_NS && d < cycle - WIRE_PHASE_RESYNC_NS;
+}
+
+int mqtt_send_bpm(char *topic, int channel, int bpm, int64_t beat_ns)
+{
+  struct mqtt_wire_tx *tx = &mqtt_wire_tx[channel & (MQTT_WIRE_CHANNELS - 1)];
+  struct wire_msg m;
+  uint8_t buf[WIRE_SIZE];
+  char msg[MQTT_MSG_MAX];
+
+  if (mqtt_wire == MQTT_WIRE_ASCII) {
+    snprintf(msg, sizeof(msg), "%d", bpm);
+    return mqtt_send_topic(topic, msg);
+  }
+
+  if (tx->bpm_seq && tx->bpm_seq == tx->seq && tx->bpm == bpm &&
+      !mqtt_phase_moved(tx, bpm, beat_ns))
+    return 0;
+
+  memset(&m, 0, sizeof(m));
+  m.channel = channel;
+  m.seq = ++tx->seq;
+  m.session = mqtt_session;
+  m.mbpm = bpm * 1000;
+  m.mono_ns = wire_monotonic();
+  m.real_ns = wire_realtime();
+  if (beat_ns) {
+    m.flags |= WIRE_F_BEAT;
+    m.beat_ns = wire_mono_to_real(beat_ns);
+  }
+  tx->bpm_seq = m.seq;
+  tx->bpm = bpm;
+  tx->beat = beat_ns;
+
+  return mqtt_send_raw(topic, buf, wire_encode(&m, buf));
+}
+
+/****************************************************************
+ * mqtt_send_beat
+ *
+ * Queue a beat event (MQTT_WIRE_BEATS only, no-op otherwise): always a
+ * new seq, so that each beat goes out even at the same bpm. Events have
+ * their own queue, not the latest-wins slot of the topic: none is
+ * replaced by a later bpm message or event. bpm 0: from ibi_ns, the
+ * interval since the previous beat (0 -> unknown).
+ ****************************************************************/
+
+int mqtt_send_beat(char *topic, int channel, int bpm, int64_t beat_ns, int64_t ibi_ns)
+{
+  struct mqtt_wire_tx *tx = &mqtt_wire_tx[channel & (MQTT_WIRE_CHANNELS - 1)];
+  struct wire_msg m;
+  uint8_t buf[WIRE_SIZE];
+
+  if (mqtt_wire != MQTT_WIRE_BEATS || !beat_ns)
+    return 0;
+
+  memset(&m, 0, sizeof(m));
+  m.channel = channel;
+  m.flags = WIRE_F_BEAT | WIRE_F_EVENT;
+  m.seq = ++tx->seq;
+  m.session = mqtt_session;
+  if (ibi_ns > 0 && ibi_ns < 0xffffffffLL * 1000)
+    m.ibi_us = ibi_ns / 1000;
+  if (!bpm && m.ibi_us)
+    bpm = (60000000 + m.ibi_us / 2) / m.ibi_us;
+  m.mbpm = bpm * 1000;
+  m.mono_ns = wire_monotonic();
+  m.real_ns = wire_realtime();
+  m.beat_ns = wire_mono_to_real(beat_ns);
+
+  return mqtt_enqueue_event(topic, buf, wire_encode(&m, buf));
+}
+
+int mqtt_send(char *msg)
+{
+  return mqtt_send_topic(mqtt_topic, msg);
+}
+
+#endif /* USE_MOSQUITTO */
@@ -0,0 +1,62 @@
+#ifndef MQTT_H
+#define MQTT_H
+
+#ifdef USE_MOSQUITTO
+
+#include <stdint.h>
+#include <mosquitto.h>
+
+#include "wire.h"
+
+/************
+ * MQTT (shared by gpioIrq and rpi_gpio)
+ ************/
+
+#define MQTT_PORT      1883
+#define MQTT_KEEPALIVE 60
+
+/*
+ * Outbound queue: mqtt_send*() only store the message in a latest-wins
+ * slot per topic, the MQTT thread publishes every MQTT_FLUSH_MS (at
+ * most) and only the slots whose value changed, or all of them every
+ * mqtt_heartbeat ms. With mqtt_batch_topic the pending updates of one
+ * flush go out as a single "<topic> <msg>" per line payload instead.
+ * Beat events (mqtt_send_beat()) are not coalesced: they wait in a FIFO
+ * of MQTT_EVENTS_MAX and go out in order with the slots.
+ */
+#define MQTT_QUEUE_MAX 16
+#define MQTT_EVENTS_MAX 32
+#define MQTT_MSG_MAX   48   /* >= WIRE_SIZE */
+#define MQTT_FLUSH_MS  50
+
+/* bpm payload format (mqtt_send_bpm(), see wire.h) */
+#define MQTT_WIRE_ASCII  0
+#define MQTT_WIRE_BINARY 1
+#define MQTT_WIRE_BEATS  2   /* binary + one beat event per beat */
+
+/* reconnection backoff (sec), the queue above is the offline buffer */
+#define MQTT_RECONNECT_MIN 1
+#define MQTT_RECONNECT_MAX 60
+
+extern struct mosquitto *mosq;
+extern char *mqtt_host;
+extern char *mqtt_topic;
+extern int mqtt_heartbeat;       /* ms, 0 -> publish on change only */
+extern char *mqtt_batch_topic;   /* NULL -> one publish per topic */
+extern int mqtt_wire;            /* MQTT_WIRE_ASCII (default), _BINARY or _BEATS */
+
+/* called from the mosquitto loop thread for each message on mqtt_topic */
+typedef void (*mqtt_msg_cb_t)(const char *payload, int len);
+
+void mqtt_setup(void);
+int mqtt_send(char *msg);
+int mqtt_send_topic(char *topic, char *msg);
+int mqtt_send_raw(char *topic, const void *msg, int len);
+int mqtt_send_bpm(char *topic, int channel, int bpm, int64_t beat_ns);
+int mqtt_send_beat(char *topic, int channel, int bpm, int64_t beat_ns, int64_t ibi_ns);
+void mqtt_flush(int force);
+void mqtt_subscribe(mqtt_msg_cb_t cb);
+
+#endif /* USE_MOSQUITTO */
+
+#endif /* MQTT_H */
@@ -0,0 +1,73 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+#include "rt.h"
+
+/****************************************************************
+ * rt_prefault_stack
+ ****************************************************************/
+
+static void __attribute__((noinline)) rt_prefault_stack(void)
+{
+  volatile unsigned char stack[RT_STACK_PREFAULT];
+
+  memset((void *)stack, 0, sizeof(stack));
+}
+
+/****************************************************************
+ * rt_prefault
+ ****************************************************************/
+
+void rt_prefault(volatile void *addr, size_t len)
+{
+  volatile unsigned char *p = addr;
+  long page = sysconf(_SC_PAGESIZE);
+  size_t i;
+
+  for (i = 0 ; i < len ; i += page)
+    (void)p[i];
+}
+
+/****************************************************************
+ * rt_setup
+ ****************************************************************/
+
+int rt_setup(int lock, int prio, int cpu)
+{
+  struct sched_param sp;
+  cpu_set_t set;
+  int err = 0;
+
+  if (lock) {
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+      perror ("mlockall");
+      err = -1;
+    }
+    else
+      rt_prefault_stack();
+  }
+
+  if (cpu >= 0) {
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) < 0) {
+      perror ("sched_setaffinity");
+      err = -1;
+    }
+  }
+
+  if (prio > 0) {
+    memset(&sp, 0, sizeof(sp));
+    sp.sched_priority = prio;
+    if (sched_setscheduler(0, SCHED_FIFO, &sp) < 0) {
+      perror ("sched_setscheduler");
+      err = -1;
+    }
+  }
+
+  return err;
+}
@@ -0,0 +1,24 @@
+#ifndef RT_H
+#define RT_H
+
+#include <stddef.h>
+
+/****************************************************************
+ * Real-time setup shared by rpi_gpio and gpioIrq
+ ****************************************************************/
+
+#define RT_STACK_PREFAULT (64*1024) /* stack bytes touched after mlockall() */
+
+/*
+ * lock: mlockall() + prefault RT_STACK_PREFAULT of stack
+ * prio: SCHED_FIFO priority (0 -> keep SCHED_OTHER)
+ * cpu:  pin to this CPU (-1 -> no pinning), e.g. one in isolcpus=
+ *
+ * Threads created afterwards inherit policy, priority and affinity.
+ */
+int rt_setup(int lock, int prio, int cpu);
+
+/* touch every page of a mapping (e.g. mmap()ed GPIO block) */
+void rt_prefault(volatile void *addr, size_t len);
+
+#endif /* RT_H */
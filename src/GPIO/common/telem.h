@@ -0,0 +1,90 @@
+#ifndef TELEM_H
+#define TELEM_H
+
+#include <stdint.h>
+
+#include "hist.h"
+
+/****************************************************************
+ * Shared memory telemetry (/dev/shm/pyramidion-<prog>)
+ *
+ * Each daemon maps one struct telem and updates its counters with
+ * plain stores between telem_begin() and telem_end() (no syscall).
+ * Readers copy the segment and retry while seq is odd or changed
+ * (seqlock). One writer thread per segment; the histograms are
+ * lock-free on their own and not covered by seq, nor are the wire
+ * counters (atomic adds from the MQTT thread).
+ *
+ * Bump TELEM_VERSION on any layout change.
+ ****************************************************************/
+
+#define TELEM_MAGIC    0x504d4c54  /* "TLMP" */
+#define TELEM_VERSION  4
+#define TELEM_DIR      "/dev/shm"
+#define TELEM_PREFIX   "pyramidion-"
+#define TELEM_CHANNELS 8
+
+struct telem_channel {
+  uint32_t gpio_in, gpio_out;
+  uint64_t bpm;        /* current bpm (0 -> unknown / idle) */
+  uint64_t edges;      /* sensor edges seen (rpi_gpio: output edges) */
+  uint64_t dropped;    /* edges dropped by the debounce filter */
+  uint64_t timeouts;   /* poll / idle timeouts */
+};
+
+struct telem {
+  /* set once by telem_open() */
+  uint32_t magic;
+  uint32_t version;
+  uint32_t size;       /* sizeof(struct telem) */
+  uint32_t nchannels;
+  int32_t pid;
+  char prog[28];
+  int64_t start;       /* CLOCK_MONOTONIC, ns */
+
+  /* seqlock, odd while the writer updates */
+  uint64_t seq;
+  uint64_t mqtt_errors;
+  uint64_t period;     /* ns (rpi_gpio) */
+  struct telem_channel ch[TELEM_CHANNELS];
+
+  struct hist jitter;  /* ns, missed periods in jitter.missed */
+
+  /* binary bpm messages received (rpi_gpio, see wire.h) */
+  uint64_t wire_rx;
+  uint64_t wire_skipped;
+  uint64_t wire_old;
+  uint64_t wire_stale;
+  struct hist latency; /* ns, sender timestamp -> led edge at the new period */
+
+  /* phase sync (rpi_gpio -P): scheduled beat start - reference beat */
+  int64_t align_err;   /* ns, last beat (covered by seq) */
+  uint64_t align_steps;/* phase jumps: first lock, clock set */
+  struct hist align;   /* |align_err| ns, one sample per beat once locked */
+
+  /* beat predictor (rpi_gpio -P + beat events), MQTT thread, atomic */
+  uint64_t pll_beats;  /* events used */
+  uint64_t pll_resets; /* grid (re)started: first event, events lost */
+  int64_t pll_err;     /* ns, last master beat - predicted beat */
+  int64_t pll_cycle;   /* ns, predicted beat interval */
+  struct hist predict; /* |pll_err| ns */
+};
+
+/* writer */
+struct telem *telem_open(char *prog, int nchannels);
+
+static inline void telem_begin(struct telem *t)
+{
+  __atomic_store_n(&t->seq, t->seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void telem_end(struct telem *t)
+{
+  __atomic_store_n(&t->seq, t->seq + 1, __ATOMIC_RELEASE);
+}
+
+/* reader: consistent copy of a segment file, -1 if not a valid one */
+int telem_read(char *path, struct telem *copy);
+
+#endif /* TELEM_H */
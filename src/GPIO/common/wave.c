@@ -0,0 +1,133 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "wave.h"
+
+static struct wave wave_cache[WAVE_CACHE];
+static uint64_t wave_clock;
+
+/* lub-dub envelope (ms) */
+#define LUB_AT     40.0
+#define LUB_WIDTH  25.0
+#define DUB_WIDTH  20.0
+#define DUB_AMP    0.6
+#define SYSTOLE    300.0   /* S1-S2 at 60 bpm */
+
+int wave_shape(char *name)
+{
+  if (!strcmp(name, "square"))
+    return WAVE_SQUARE;
+  if (!strcmp(name, "lubdub"))
+    return WAVE_LUBDUB;
+
+  return -1;
+}
+
+/****************************************************************
+ * Table builders
+ ****************************************************************/
+
+static void wave_edge(struct wave *w, int64_t at, int level)
+{
+  // only level changes, last slot kept for the final off
+  if (w->n && w->level[w->n - 1] == level)
+    return;
+  if (!w->n && !level)
+    return;
+  if (w->n >= WAVE_STEPS_MAX - 1 && level)
+    return;
+
+  w->at[w->n] = at;
+  w->level[w->n++] = level;
+}
+
+static double gauss(double t, double at, double width)
+{
+  return exp(-(t - at) * (t - at) / (2 * width * width));
+}
+
+static void wave_build_lubdub(struct wave *w)
+{
+  double ms = w->cycle / 1e6, lub_w = LUB_WIDTH, dub_w = DUB_WIDTH, dub_at, t, b;
+  int64_t slot, on;
+  int q;
+
+  // Bazett like systole, both peaks kept inside the cycle
+  dub_at = LUB_AT + SYSTOLE * sqrt(ms / 1000);
+  if (dub_at > 0.45 * ms)
+    dub_at = 0.45 * ms;
+  if (lub_w > ms / 20)
+    lub_w = dub_w = ms / 20;
+
+  for (slot = 0 ; slot + WAVE_PWM_NS <= w->cycle ; slot += WAVE_PWM_NS) {
+    t = (slot + WAVE_PWM_NS / 2) / 1e6;
+    b = gauss(t, LUB_AT, lub_w) + DUB_AMP * gauss(t, dub_at, dub_w);
+    q = (int)(b * WAVE_LEVELS + 0.5);
+    if (q > WAVE_LEVELS)
+      q = WAVE_LEVELS;
+
+    on = (int64_t)WAVE_PWM_NS * q / WAVE_LEVELS;
+    if (on > 0)
+      wave_edge(w, slot, 1);
+    if (on < WAVE_PWM_NS)
+      wave_edge(w, slot + on, 0);
+  }
+}
+
+static void wave_build(struct wave *w)
+{
+  w->n = 0;
+
+  if (w->shape == WAVE_LUBDUB)
+    wave_build_lubdub(w);
+  else {
+    wave_edge(w, 0, 1);
+    wave_edge(w, w->cycle / 2, 0);
+  }
+
+  // always off at the end of the cycle
+  if (!w->n || w->level[w->n - 1]) {
+    w->at[w->n] = w->n ? w->at[w->n - 1] : 0;
+    w->level[w->n++] = 0;
+  }
+}
+
+/****************************************************************
+ * wave_get (cached) / wave_put
+ ****************************************************************/
+
+struct wave *wave_get(int shape, int64_t cycle)
+{
+  struct wave *w, *lru = NULL;
+  int i;
+
+  for (i = 0 ; i < WAVE_CACHE ; i++) {
+    w = &wave_cache[i];
+    if (w->cycle == cycle && w->shape == shape)
+      goto found;
+    if (!w->refs && (!lru || w->used < lru->used))
+      lru = w;
+  }
+
+  if ((w = lru) == NULL) {
+    fprintf(stderr, "wave: cache full\n");
+    return NULL;
+  }
+
+  w->shape = shape;
+  w->cycle = cycle;
+  wave_build(w);
+
+found:
+  w->refs++;
+  w->used = ++wave_clock;
+
+  return w;
+}
+
+void wave_put(struct wave *w)
+{
+  if (w && w->refs > 0)
+    w->refs--;
+}
@@ -0,0 +1,44 @@
+#ifndef WAVE_H
+#define WAVE_H
+
+#include <stdint.h>
+
+/****************************************************************
+ * Heartbeat waveform tables
+ *
+ * A table is the list of output edges of one beat cycle: time from
+ * the cycle start (ns, increasing) and level to set. The lub-dub
+ * shape is a two peak brightness envelope (S1 then a weaker S2, the
+ * S1-S2 delay shrinking with the cycle as a real systole does)
+ * rendered as a WAVE_PWM_NS software PWM with WAVE_LEVELS steps, so
+ * playback is only timed GPIO set/clear, no math.
+ *
+ * Tables are built by wave_get() the first time a (shape, cycle) is
+ * asked for and kept in a small LRU cache: a bpm seen before costs
+ * nothing. Not thread safe, one thread per process uses it.
+ ****************************************************************/
+
+#define WAVE_SQUARE 0
+#define WAVE_LUBDUB 1
+
+#define WAVE_STEPS_MAX 256
+#define WAVE_PWM_NS    4000000   /* 250 Hz PWM carrier */
+#define WAVE_LEVELS    16
+#define WAVE_CACHE     8
+
+struct wave {
+  int shape;
+  int64_t cycle;       /* ns, 60 s / bpm */
+  int n;               /* edges in the cycle */
+  int64_t at[WAVE_STEPS_MAX];
+  uint8_t level[WAVE_STEPS_MAX];
+
+  int refs;            /* in use, not evicted */
+  uint64_t used;       /* LRU stamp */
+};
+
+int wave_shape(char *name);                      /* -1 if unknown */
+struct wave *wave_get(int shape, int64_t cycle); /* NULL if full */
+void wave_put(struct wave *w);
+
+#endif /* WAVE_H */
@@ -0,0 +1,186 @@
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "wire.h"
+
+/****************************************************************
+ * Clocks
+ ****************************************************************/
+
+int64_t wire_monotonic(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int64_t wire_realtime(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* CLOCK_MONOTONIC timestamp (edges) -> CLOCK_REALTIME, for the peer */
+int64_t wire_mono_to_real(int64_t mono_ns)
+{
+  int64_t real = wire_realtime();
+
+  return real - (wire_monotonic() - mono_ns);
+}
+
+/* session id of this sender process (never 0) */
+uint32_t wire_session_new(void)
+{
+  uint64_t x = (uint64_t)wire_realtime() ^ ((uint64_t)getpid() << 32) ^ (uint64_t)wire_monotonic();
+  uint32_t s;
+
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdULL;
+  x ^= x >> 33;
+  s = (uint32_t)x;
+
+  return s ? s : 1;
+}
+
+/****************************************************************
+ * Byte order helpers (the Pi and x86 are little endian, but the
+ * format does not depend on it)
+ ****************************************************************/
+
+static void put32(uint8_t *p, uint32_t v)
+{
+  int i;
+
+  for (i = 0 ; i < 4 ; i++)
+    p[i] = v >> (8 * i);
+}
+
+static void put64(uint8_t *p, int64_t v)
+{
+  put32(p, (uint64_t)v);
+  put32(p + 4, (uint64_t)v >> 32);
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static int64_t get64(const uint8_t *p)
+{
+  return (int64_t)(get32(p) | ((uint64_t)get32(p + 4) << 32));
+}
+
+/****************************************************************
+ * wire_encode (buf holds WIRE_SIZE bytes, returns the length)
+ ****************************************************************/
+
+int wire_encode(struct wire_msg *m, uint8_t *buf)
+{
+  buf[0] = WIRE_MAGIC;
+  buf[1] = WIRE_VERSION;
+  buf[2] = m->channel;
+  buf[3] = m->flags & ~WIRE_F_ASCII;
+  put32(buf + 4, m->seq);
+  put32(buf + 8, m->mbpm);
+  put32(buf + 12, m->ibi_us);
+  put64(buf + 16, m->mono_ns);
+  put64(buf + 24, m->real_ns);
+  put64(buf + 32, m->beat_ns);
+  put32(buf + 40, m->session);
+
+  return WIRE_SIZE;
+}
+
+/****************************************************************
+ * wire_decode (binary or ASCII payload, -1 if neither)
+ ****************************************************************/
+
+int wire_decode(const void *payload, int len, struct wire_msg *m)
+{
+  const uint8_t *p = payload;
+  int i, bpm = 0;
+
+  memset(m, 0, sizeof(*m));
+
+  if (len >= WIRE_SIZE_V2 && p[0] == WIRE_MAGIC) {
+    if (p[1] < 1 || (p[1] >= 3 && len < WIRE_SIZE))
+      return -1;
+
+    m->version = p[1];
+    m->channel = p[2];
+    m->flags = p[3] & ~WIRE_F_ASCII;
+    m->seq = get32(p + 4);
+    m->mbpm = get32(p + 8);
+    m->ibi_us = get32(p + 12);
+    m->mono_ns = get64(p + 16);
+    m->real_ns = get64(p + 24);
+    m->beat_ns = get64(p + 32);
+    if (m->version >= 3)
+      m->session = get32(p + 40);
+
+    return 0;
+  }
+
+  // "72", "72\n"...
+  for (i = 0 ; i < len && p[i] >= '0' && p[i] <= '9' ; i++)
+    bpm = bpm * 10 + p[i] - '0';
+  if (i == 0 || i > 6)
+    return -1;
+
+  m->flags = WIRE_F_ASCII;
+  m->mbpm = bpm * 1000;
+
+  return 0;
+}
+
+/****************************************************************
+ * wire_rx_check
+ *
+ * Drop what is older than the last accepted message (seq) or than
+ * max_age_ns (sender realtime, needs NTP on both sides, 0 -> no
+ * check). ASCII messages carry neither and are always accepted. A new
+ * sender session starts the seq check over.
+ ****************************************************************/
+
+int wire_rx_check(struct wire_rx *rx, struct wire_msg *m, int64_t max_age_ns)
+{
+  int32_t d;
+
+  if (m->flags & WIRE_F_ASCII)
+    return WIRE_RX_OK;
+
+  if (max_age_ns && wire_realtime() - m->real_ns > max_age_ns) {
+    rx->stale++;
+    return WIRE_RX_STALE;
+  }
+
+  if (rx->valid && m->session != rx->session) {
+    rx->valid = 0;
+    rx->sessions++;
+  }
+
+  if (rx->valid) {
+    // same seq: heartbeat / replay after reconnection, not counted
+    d = (int32_t)(m->seq - rx->seq);
+    if (d <= 0 && d > -WIRE_SEQ_WINDOW) {
+      if (d)
+	rx->old++;
+      return WIRE_RX_OLD;
+    }
+    if (d > 1)
+      rx->skipped += d - 1;
+  }
+
+  rx->valid = 1;
+  rx->session = m->session;
+  rx->seq = m->seq;
+
+  return WIRE_RX_OK;
+}
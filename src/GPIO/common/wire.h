@@ -0,0 +1,99 @@
+#ifndef WIRE_H
+#define WIRE_H
+
+#include <stdint.h>
+
+/****************************************************************
+ * BPM wire format (master -> slave, shared encode/decode)
+ *
+ * ASCII: the bpm as a decimal string ("72"), what the first versions
+ * published and the shell scripts understand.
+ *
+ * Binary (version 3), WIRE_SIZE bytes, little endian:
+ *
+ *   0  u8  magic (WIRE_MAGIC, never an ASCII digit)
+ *   1  u8  version
+ *   2  u8  channel
+ *   3  u8  flags (WIRE_F_*)
+ *   4  u32 seq      per channel, +1 per new value
+ *   8  u32 mbpm     bpm * 1000
+ *  12  u32 ibi_us   beat interval ending at beat_ns (WIRE_F_EVENT), 0
+ *                  -> unknown (version 1: reserved, 0)
+ *  16  i64 mono_ns  sender CLOCK_MONOTONIC at encode time
+ *  24  i64 real_ns  sender CLOCK_REALTIME at encode time
+ *  32  i64 beat_ns  CLOCK_REALTIME of the last beat (WIRE_F_BEAT)
+ *  40  u32 session  sender process, random at its start, 0 -> unknown
+ *                  (versions 1-2 end at offset 40)
+ *
+ * seq starts again at 1 when the sender restarts: a new session resets
+ * the receiver seq check, so the first message of the new process is
+ * accepted instead of looking like a late one.
+ *
+ * beat_ns is the phase reference: the sender beats at beat_ns + k x
+ * 60/bpm s, so a receiver can put its own beats on the same grid
+ * (CLOCK_REALTIME on both sides, NTP or PTP disciplined). A new one is
+ * sent (next seq) when the beats drift off the previous grid by more
+ * than WIRE_PHASE_RESYNC_NS.
+ *
+ * With WIRE_F_EVENT the message is a beat event, sent as the master
+ * detects the beat: beat_ns is that beat, mbpm the current estimate.
+ * The receiver predicts the next beats from them (no wait for the bpm
+ * window, network latency hidden), see rpi_gpio/pll.h.
+ *
+ * Decoders accept both forms and any version >= 1 with at least its
+ * size (WIRE_SIZE_V2 up to version 2, fields are only appended).
+ ****************************************************************/
+
+#define WIRE_MAGIC   0xb7
+#define WIRE_VERSION 3
+#define WIRE_SIZE    44
+#define WIRE_SIZE_V2 40     /* versions 1 and 2, no session */
+
+#define WIRE_F_BEAT  0x01   /* beat_ns is valid */
+#define WIRE_F_EVENT 0x02   /* beat event: beat_ns just happened */
+#define WIRE_F_ASCII 0x80   /* decoded from the ASCII form (no seq/ts) */
+
+/* seq going back by less than this is a late/duplicate message, more
+   than this is a restarted sender (without a session, versions 1-2) */
+#define WIRE_SEQ_WINDOW 1024
+
+#define WIRE_PHASE_RESYNC_NS 20000000   /* 20 ms */
+
+struct wire_msg {
+  uint8_t version;
+  uint8_t channel;
+  uint8_t flags;
+  uint32_t seq;
+  uint32_t mbpm;
+  uint32_t ibi_us;
+  int64_t mono_ns;
+  int64_t real_ns;
+  int64_t beat_ns;
+  uint32_t session;
+};
+
+/* receiver state, one per channel/topic */
+struct wire_rx {
+  int valid;
+  uint32_t session;    /* of the last accepted message */
+  uint32_t seq;
+  uint64_t skipped;    /* seq gaps: coalesced by the sender queue or lost */
+  uint64_t old;        /* duplicates / reordered, dropped */
+  uint64_t stale;      /* older than max_age, dropped */
+  uint64_t sessions;   /* sender restarts seen (new session) */
+};
+
+#define WIRE_RX_OK    0
+#define WIRE_RX_OLD   1
+#define WIRE_RX_STALE 2
+
+int64_t wire_monotonic(void);
+int64_t wire_realtime(void);
+int64_t wire_mono_to_real(int64_t mono_ns);
+uint32_t wire_session_new(void);
+
+int wire_encode(struct wire_msg *m, uint8_t *buf);
+int wire_decode(const void *payload, int len, struct wire_msg *m);
+int wire_rx_check(struct wire_rx *rx, struct wire_msg *m, int64_t max_age_ns);
+
+#endif /* WIRE_H */
@@ -0,0 +1,128 @@
+#include <string.h>
+
+#include "beat.h"
+
+#define BEAT_RING_MASK (BEAT_RING_SIZE - 1)
+
+/****************************************************************
+ * beat_ring_push (producer)
+ ****************************************************************/
+
+void beat_ring_push(struct beat_ring *r, int64_t ts)
+{
+  uint64_t h = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+
+  __atomic_store_n(&r->ts[h & BEAT_RING_MASK], ts, __ATOMIC_RELAXED);
+  __atomic_store_n(&r->head, h + 1, __ATOMIC_RELEASE);
+}
+
+/****************************************************************
+ * beat_ring_pop (consumer, *tail is its read position)
+ *
+ * Return 1 and the next timestamp, 0 if the ring is empty.
+ ****************************************************************/
+
+int beat_ring_pop(struct beat_ring *r, uint64_t *tail, int64_t *ts)
+{
+  uint64_t h;
+
+  while (1) {
+    h = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    if (*tail == h)
+      return 0;
+
+    // overrun -> skip to the oldest slot still valid
+    if (h - *tail > BEAT_RING_SIZE)
+      *tail = h - BEAT_RING_SIZE;
+
+    *ts = __atomic_load_n(&r->ts[*tail & BEAT_RING_MASK], __ATOMIC_RELAXED);
+
+    // slot not overwritten while reading ?
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&r->head, __ATOMIC_RELAXED) - *tail <= BEAT_RING_SIZE) {
+      (*tail)++;
+      return 1;
+    }
+  }
+}
+
+/****************************************************************
+ * bpm_est_init
+ ****************************************************************/
+
+void bpm_est_init(struct bpm_est *e, int min)
+{
+  memset(e, 0, sizeof(*e));
+
+  if (min < 1)
+    min = BEAT_MIN;
+  if (min > BEAT_WINDOW)
+    min = BEAT_WINDOW;
+  e->min = min;
+  e->step = 2;
+}
+
+/****************************************************************
+ * bpm_est_gap
+ *
+ * Missed beat(s) before the next edge: start a new interval chain,
+ * the intervals already measured are kept.
+ ****************************************************************/
+
+void bpm_est_gap(struct bpm_est *e)
+{
+  e->nedges = 0;
+}
+
+/****************************************************************
+ * bpm_est_add
+ *
+ * Add an edge, return the current bpm (0 if not known yet).
+ * A negative ts is edge -ts after a gap (FILTER_GAP through the ring).
+ ****************************************************************/
+
+int bpm_est_add(struct bpm_est *e, int64_t ts)
+{
+  int64_t iv, sorted[BEAT_WINDOW];
+  int i, j, bpm;
+
+  if (ts < 0) {
+    bpm_est_gap(e);
+    ts = -ts;
+  }
+
+  if (e->nedges < e->step) {
+    e->edge[e->nedges++] = ts;
+    if (e->step == 1)
+      e->edge[1] = ts;
+    return e->bpm;
+  }
+
+  iv = ts - e->edge[2 - e->step];
+  e->edge[0] = e->edge[1];
+  e->edge[1] = ts;
+
+  // out of range -> not a beat (noise or dropout)
+  if (iv < 60000000000LL / BEAT_MAX_BPM || iv > 60000000000LL / BEAT_MIN_BPM)
+    return e->bpm;
+
+  e->iv[e->pos] = iv;
+  e->pos = (e->pos + 1) % BEAT_WINDOW;
+  if (e->niv < BEAT_WINDOW)
+    e->niv++;
+
+  if (e->niv < e->min)
+    return e->bpm;
+
+  // median (insertion sort, BEAT_WINDOW is small)
+  for (i = 0 ; i < e->niv ; i++) {
+    for (j = i ; j > 0 && sorted[j-1] > e->iv[i] ; j--)
+      sorted[j] = sorted[j-1];
+    sorted[j] = e->iv[i];
+  }
+
+  bpm = (int)((60000000000LL + sorted[e->niv / 2] / 2) / sorted[e->niv / 2]);
+  __atomic_store_n(&e->bpm, bpm, __ATOMIC_RELAXED);
+
+  return bpm;
+}
@@ -0,0 +1,49 @@
+#ifndef BEAT_H
+#define BEAT_H
+
+#include <stdint.h>
+
+/****************************************************************
+ * Beat ring buffer + BPM estimator
+ ****************************************************************/
+
+#define BEAT_RING_SIZE  64  /* edge timestamps kept, power of 2 */
+#define BEAT_WINDOW     7   /* beat intervals in the median */
+#define BEAT_MIN        4   /* intervals needed before trusting the bpm */
+#define BEAT_MIN_BPM    20
+#define BEAT_MAX_BPM    200
+
+/*
+ * Single producer (poll loop) / single consumer (output thread) ring of
+ * edge timestamps (CLOCK_MONOTONIC, ns), no lock. The producer never
+ * waits: if the consumer is late the oldest timestamps are lost.
+ */
+struct beat_ring {
+  int64_t ts[BEAT_RING_SIZE];
+  uint64_t head;   /* next slot to write (producer) */
+};
+
+/*
+ * Streaming estimator: the sensor edge is configured on "both", so a beat
+ * is two edges and the beat interval is ts[n] - ts[n-2] (whatever the
+ * pulse duty cycle). bpm is the median of the last BEAT_WINDOW intervals,
+ * updated on every edge. With rising edges only (filter.h) set step to 1.
+ */
+struct bpm_est {
+  int64_t edge[2];            /* two previous edges */
+  int nedges;
+  int step;                   /* edges per beat (2, or 1 if rising only) */
+  int64_t iv[BEAT_WINDOW];    /* last beat intervals (circular) */
+  int niv, pos;
+  int min;                    /* intervals needed (BEAT_MIN by default) */
+  int bpm;                    /* 0 -> not known yet */
+};
+
+void beat_ring_push(struct beat_ring *r, int64_t ts);
+int beat_ring_pop(struct beat_ring *r, uint64_t *tail, int64_t *ts);
+
+void bpm_est_init(struct bpm_est *e, int min);
+int bpm_est_add(struct bpm_est *e, int64_t ts);
+void bpm_est_gap(struct bpm_est *e);
+
+#endif /* BEAT_H */
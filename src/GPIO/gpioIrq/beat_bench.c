@@ -0,0 +1,290 @@
+//
+// beat_bench: feed recorded (gpioIrq -R) or synthetic sensor edges
+// through the beat ring + bpm estimator used by gpioIrq_th, without
+// hardware, and report estimation error, time to first bpm and CPU
+// time per edge.
+//
+// Synthetic traces: steady, noisy (jitter + glitches), dropout (missed
+// beats + gaps), arrhythmic (+/- 15% intervals).
+//
+// With -e / -l the run fails (exit 2) if the mean bpm error or the time
+// to the first bpm is over the limit: make bench runs the synthetic
+// traces through the daemons' default filter with per-trace limits.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "gpio.h"
+#include "beat.h"
+#include "trace.h"
+#include "filter.h"
+
+#define GEN_STEADY     0
+#define GEN_NOISY      1
+#define GEN_DROPOUT    2
+#define GEN_ARRHYTHMIC 3
+
+#define PULSE_WIDTH   100000000LL   /* sensor pulse, ns */
+#define GLITCH_WIDTH  2000000LL     /* noise pulse, ns */
+#define ERR_PCT       5             /* "wrong" bpm threshold */
+
+char *gen_names[] = { "steady", "noisy", "dropout", "arrhythmic", NULL };
+
+int gen = GEN_STEADY;
+int bpm_true = 72;
+int duration = 60;            /* sec */
+double speed = 0;             /* 0 -> as fast as possible */
+double max_err = -1;          /* -e, %, < 0 -> no limit */
+double max_latency = -1;      /* -l, s, < 0 -> no limit */
+int verbose;
+
+// synthetic edge source
+struct gen_state {
+  int64_t beat;               /* next beat, ns */
+  int64_t pending[4];         /* edges of the current beat */
+  int npending, next;
+  unsigned int value;
+};
+
+double gauss (void)
+{
+  double u = drand48 () + 1e-12, v = drand48 ();
+
+  return sqrt (-2 * log (u)) * cos (2 * M_PI * v);
+}
+
+// next edge from the generator, 0 at end of duration
+int gen_edge (struct gen_state *g, struct gpio_edge *e)
+{
+  int64_t iv = 60000000000LL / bpm_true, t;
+
+  while (g->next == g->npending) {
+    if (g->beat > (int64_t)duration * 1000000000)
+      return 0;
+
+    g->npending = g->next = 0;
+    t = g->beat;
+
+    switch (gen) {
+    case GEN_NOISY:
+      t += (int64_t)(gauss () * 0.03 * iv);
+      break;
+    case GEN_ARRHYTHMIC:
+      iv = (int64_t)(iv * (0.85 + 0.3 * drand48 ()));
+      break;
+    }
+
+    // dropout: 10% missed beats + 3 s gap every 20 s
+    if (gen == GEN_DROPOUT && (drand48 () < 0.1 || (g->beat / 1000000000) % 20 >= 17)) {
+      g->beat += iv;
+      continue;
+    }
+
+    g->pending[g->npending++] = t;
+    g->pending[g->npending++] = t + PULSE_WIDTH;
+
+    // noisy: 5% glitch between two beats
+    if (gen == GEN_NOISY && drand48 () < 0.05) {
+      g->pending[g->npending++] = t + iv / 2;
+      g->pending[g->npending++] = t + iv / 2 + GLITCH_WIDTH;
+    }
+
+    g->beat += iv;
+  }
+
+  e->ts = g->pending[g->next++];
+  e->value = g->value = !g->value;
+
+  return 1;
+}
+
+void usage (void)
+{
+  printf("\t-g <steady|noisy|dropout|arrhythmic> (synthetic, default steady)\n\t-t <trace> (replay gpioIrq -R trace)\n\t-b <bpm> (true bpm)\n\t-d <sec> (synthetic duration)\n\t-s <speed> (x real time, default as fast as possible)\n\t-w <n> (beat intervals before bpm)\n\t-S <seed>\n\t-E <filter> (edge filter spec, default " FILTER_DEFAULT ")\n\t-e <max-bpm-err%%> (mean, exit 2 above)\n\t-l <max-latency-s> (time to first bpm, exit 2 above)\n\t-o <trace> (save the edges)\n\t-v verbose\n\n");
+  exit (1);
+}
+
+int64_t cpu_time (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_PROCESS_CPUTIME_ID, &ts);
+
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int main(int ac, char **av)
+{
+  struct gen_state g;
+  struct trace in, out;
+  struct gpio_edge e;
+  struct beat_ring ring;
+  struct bpm_est est;
+  struct timespec ts;
+  struct edge_filter flt;
+  char *cp, *trace_in = NULL, *trace_out = NULL, *filter_spec = FILTER_DEFAULT;
+  int r;
+  uint64_t tail = 0;
+  int64_t t0 = -1, t_first = -1, cpu, rts, ets, wall0;
+  int64_t edges = 0, samples = 0, bad = 0;
+  double err, err_sum = 0, err_max = 0;
+  int i, bpm, wait_beats = BEAT_MIN, fail = 0;
+  long seed = 1;
+
+  while (--ac) {
+    if ((cp = *++av) == NULL)
+      break;
+    if (*cp == '-' && *++cp) {
+      switch(*cp) {
+      case 'g' :
+	cp = *++av;
+	for (i = 0 ; gen_names[i] && strcmp (gen_names[i], cp) ; i++)
+	  ;
+	if (!gen_names[i])
+	  usage();
+	gen = i;
+	break;
+
+      case 't' :
+	trace_in = *++av; break;
+
+      case 'b' :
+	bpm_true = atoi(*++av); break;
+
+      case 'd' :
+	duration = atoi(*++av); break;
+
+      case 's' :
+	speed = atof(*++av); break;
+
+      case 'w' :
+	wait_beats = atoi(*++av); break;
+
+      case 'S' :
+	seed = atol(*++av); break;
+
+      case 'E' :
+	filter_spec = *++av; break;
+
+      case 'e' :
+	max_err = atof(*++av); break;
+
+      case 'l' :
+	max_latency = atof(*++av); break;
+
+      case 'o' :
+	trace_out = *++av; break;
+
+      case 'v' :
+	verbose = 1; break;
+
+      default: 
+	usage();
+      }
+    }
+    else
+      break;
+  }
+
+  if (bpm_true <= 0)
+    usage();
+
+  srand48 (seed);
+  memset (&g, 0, sizeof(g));
+  memset (&ring, 0, sizeof(ring));
+  memset (&out, 0, sizeof(out));
+  bpm_est_init (&est, wait_beats);
+  if (edge_filter_init (&flt, filter_spec) < 0)
+    usage();
+  if (flt.flags & FILTER_RISING)
+    est.step = 1;
+
+  if (trace_in && trace_open_read (&in, trace_in) < 0)
+    exit (1);
+  if (trace_out && trace_open_write (&out, trace_out) < 0)
+    exit (1);
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  wall0 = (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+  cpu = cpu_time ();
+
+  while (trace_in ? trace_read (&in, &e) : gen_edge (&g, &e)) {
+    if (t0 < 0)
+      t0 = e.ts;
+
+    // paced replay: wait for the edge time / speed
+    if (speed > 0) {
+      rts = wall0 + (int64_t)((e.ts - t0) / speed);
+      ts.tv_sec = rts / 1000000000;
+      ts.tv_nsec = rts % 1000000000;
+      clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+    }
+
+    trace_write (&out, &e);
+
+    edges++;
+
+    // same path as gpioIrq_th: poll loop (filter) -> ring -> output thread
+    r = edge_filter_add (&flt, &e);
+    if (r & FILTER_RESET) {
+      bpm_est_init (&est, wait_beats);
+      if (flt.flags & FILTER_RISING)
+	est.step = 1;
+    }
+    if (r & FILTER_BEAT)
+      beat_ring_push (&ring, (r & FILTER_GAP) ? -e.ts : e.ts);
+    while (beat_ring_pop (&ring, &tail, &ets))
+      bpm_est_add (&est, ets);
+    edge_filter_bpm (&flt, est.bpm);
+
+    bpm = est.bpm;
+    if (!bpm)
+      continue;
+
+    if (t_first < 0)
+      t_first = e.ts - t0;
+
+    err = fabs (bpm - bpm_true) * 100.0 / bpm_true;
+    err_sum += err;
+    if (err > err_max)
+      err_max = err;
+    if (err > ERR_PCT)
+      bad++;
+    samples++;
+
+    if (verbose)
+      printf ("%.3f s bpm= %d\n", (e.ts - t0) / 1e9, bpm);
+  }
+
+  cpu = cpu_time () - cpu;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  rts = (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec - wall0;
+
+  if (trace_in)
+    trace_close (&in);
+  trace_close (&out);
+
+  printf ("%s: %lld edges, true bpm= %d, last bpm= %d\n", trace_in ? trace_in : gen_names[gen], (long long)edges, bpm_true, est.bpm);
+  if (t_first >= 0)
+    printf ("time to first bpm= %.3f s\n", t_first / 1e9);
+  else
+    printf ("time to first bpm= never\n");
+  if (samples)
+    printf ("error: mean= %.2f%% max= %.2f%% >%d%%= %.1f%% of edges\n", err_sum / samples, err_max, ERR_PCT, bad * 100.0 / samples);
+  if (edges)
+    printf ("cpu= %lld ns/edge, speed= x%.0f\n", (long long)(cpu / edges), rts ? (double)(e.ts - t0) / rts : 0);
+
+  if (max_err >= 0 && (!samples || err_sum / samples > max_err)) {
+    printf ("FAILED: mean error over %.2f%%\n", max_err);
+    fail = 1;
+  }
+  if (max_latency >= 0 && (t_first < 0 || t_first / 1e9 > max_latency)) {
+    printf ("FAILED: time to first bpm over %.3f s\n", max_latency);
+    fail = 1;
+  }
+
+  return fail ? 2 : 0;
+}
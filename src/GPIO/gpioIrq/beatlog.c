@@ -0,0 +1,78 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "beatlog.h"
+
+/****************************************************************
+ * beatlog_open (new file for this session)
+ ****************************************************************/
+
+int beatlog_open(struct beatlog *l, char *dir)
+{
+  struct timespec mono, real;
+  struct tm tm;
+  char file[256];
+  void *map;
+  int fd;
+
+  memset(l, 0, sizeof(*l));
+  l->size = sizeof(struct beatlog_header) + BEATLOG_RECORDS * sizeof(struct beatlog_rec);
+
+  clock_gettime(CLOCK_MONOTONIC, &mono);
+  clock_gettime(CLOCK_REALTIME, &real);
+  localtime_r(&real.tv_sec, &tm);
+
+  snprintf(file, sizeof(file), "%s/beatlog-%04d%02d%02d-%02d%02d%02d.bin", dir,
+	   tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec);
+
+  if ((fd = open(file, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0) {
+    perror(file);
+    return -1;
+  }
+
+  if (ftruncate(fd, l->size) < 0) {
+    perror("beatlog/ftruncate");
+    close(fd);
+    return -1;
+  }
+
+  map = mmap(NULL, l->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    perror("beatlog/mmap");
+    return -1;
+  }
+
+  /* allocate the blocks + fault the pages in now, not in the poll loop */
+  memset(map, 0, l->size);
+
+  l->hdr = map;
+  l->rec = (struct beatlog_rec *)(l->hdr + 1);
+
+  l->hdr->version = BEATLOG_VERSION;
+  l->hdr->rec_size = sizeof(struct beatlog_rec);
+  l->hdr->records = BEATLOG_RECORDS;
+  l->hdr->start_mono = (int64_t)mono.tv_sec * 1000000000 + mono.tv_nsec;
+  l->hdr->start_real = (int64_t)real.tv_sec * 1000000000 + real.tv_nsec;
+  l->hdr->magic = BEATLOG_MAGIC;
+
+  return 0;
+}
+
+/****************************************************************
+ * beatlog_close
+ ****************************************************************/
+
+void beatlog_close(struct beatlog *l)
+{
+  if (!l->hdr)
+    return;
+
+  msync(l->hdr, l->size, MS_SYNC);
+  munmap(l->hdr, l->size);
+  l->hdr = NULL;
+}
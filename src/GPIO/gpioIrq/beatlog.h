@@ -0,0 +1,79 @@
+#ifndef BEATLOG_H
+#define BEATLOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/****************************************************************
+ * Beat log (gpioIrq -L <dir>, beatlog_csv)
+ *
+ * One file per session (<dir>/beatlog-YYYYMMDD-HHMMSS.bin): header
+ * then a ring of BEATLOG_RECORDS fixed size records, mmap()ed and
+ * prefaulted at open, so logging an event is a few stores from the
+ * poll loop (the kernel writes the pages back). When the ring is full
+ * the oldest records are overwritten; 'head' counts all of them.
+ ****************************************************************/
+
+#define BEATLOG_MAGIC    0x4c425950  /* "PYBL" */
+#define BEATLOG_VERSION  1
+#define BEATLOG_RECORDS  (1 << 18)   /* 4 MB, > 6 h of 200 bpm edges */
+
+/* record types */
+#define BEATLOG_EDGE    0   /* value = level, sensor edge copied to the led */
+#define BEATLOG_DROP    1   /* value = level, edge dropped by the filter */
+#define BEATLOG_BPM     2   /* value = bpm (0 -> lost) */
+#define BEATLOG_MODE    3   /* value = BEATLOG_MODE_* */
+#define BEATLOG_BUTTON  4   /* value = new idle bpm */
+
+#define BEATLOG_MODE_IDLE   0
+#define BEATLOG_MODE_SENSOR 1
+#define BEATLOG_MODE_OFF    2   /* stopped by the master switch/schedule */
+
+struct beatlog_header {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t rec_size;
+  uint32_t records;     /* ring size */
+  int64_t start_mono;   /* CLOCK_MONOTONIC at open, ns */
+  int64_t start_real;   /* CLOCK_REALTIME at open, ns */
+  uint64_t head;        /* records written since open */
+  uint64_t pad[3];
+};
+
+struct beatlog_rec {
+  int64_t ts;           /* CLOCK_MONOTONIC, ns */
+  uint8_t type;
+  uint8_t channel;
+  uint16_t value;
+  uint32_t seq;         /* record number + 1 (low bits), 0 -> empty */
+};
+
+struct beatlog {
+  struct beatlog_header *hdr;   /* NULL -> logging disabled */
+  struct beatlog_rec *rec;
+  size_t size;
+};
+
+int beatlog_open(struct beatlog *l, char *dir);
+void beatlog_close(struct beatlog *l);
+
+/* single writer (poll loop) */
+static inline void beatlog_add(struct beatlog *l, int type, int channel, int value, int64_t ts)
+{
+  struct beatlog_rec *r;
+  uint64_t n;
+
+  if (!l->hdr)
+    return;
+
+  n = l->hdr->head;
+  r = &l->rec[n & (BEATLOG_RECORDS - 1)];
+  r->ts = ts;
+  r->type = type;
+  r->channel = channel;
+  r->value = value;
+  __atomic_store_n(&r->seq, (uint32_t)(n + 1), __ATOMIC_RELEASE);
+  __atomic_store_n(&l->hdr->head, n + 1, __ATOMIC_RELEASE);
+}
+
+#endif /* BEATLOG_H */
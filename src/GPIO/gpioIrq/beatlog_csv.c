@@ -0,0 +1,94 @@
+//
+// beatlog_csv: export a gpioIrq beat log (-L) to CSV on stdout
+//
+//   time,ts_ns,channel,event,value
+//
+// time is the wall clock (from the session start), ts_ns the
+// CLOCK_MONOTONIC edge timestamp.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "beatlog.h"
+
+char *type_names[] = { "edge", "drop", "bpm", "mode", "button" };
+
+void usage (char *s)
+{
+  fprintf (stderr, "Usage: %s beatlog-file\n", s);
+  exit (1);
+}
+
+int main(int ac, char **av)
+{
+  struct beatlog_header *h;
+  struct beatlog_rec *r;
+  struct stat st;
+  struct tm tm;
+  time_t sec;
+  uint64_t i, first, head;
+  int64_t real;
+  char date[32];
+  void *map;
+  int fd;
+
+  if (ac != 2)
+    usage (av[0]);
+
+  if ((fd = open (av[1], O_RDONLY)) < 0 || fstat (fd, &st) < 0) {
+    perror (av[1]);
+    exit (1);
+  }
+
+  if (st.st_size < (off_t)sizeof(*h)) {
+    fprintf (stderr, "%s: too short\n", av[1]);
+    exit (1);
+  }
+
+  map = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close (fd);
+  if (map == MAP_FAILED) {
+    perror ("mmap");
+    exit (1);
+  }
+
+  h = map;
+  if (h->magic != BEATLOG_MAGIC || h->version != BEATLOG_VERSION || h->rec_size != sizeof(*r) ||
+      st.st_size < (off_t)(sizeof(*h) + (uint64_t)h->records * sizeof(*r))) {
+    fprintf (stderr, "%s: not a beat log (version %u)\n", av[1], h->version);
+    exit (1);
+  }
+
+  // oldest record still in the ring (the file may be still written)
+  r = (struct beatlog_rec *)(h + 1);
+  head = __atomic_load_n (&h->head, __ATOMIC_ACQUIRE);
+  first = head > h->records ? head - h->records : 0;
+
+  printf ("time,ts_ns,channel,event,value\n");
+
+  for (i = first ; i < head ; i++) {
+    struct beatlog_rec *p = &r[i % h->records];
+
+    // overwritten since we read head
+    if (__atomic_load_n (&p->seq, __ATOMIC_ACQUIRE) != (uint32_t)(i + 1))
+      continue;
+
+    real = h->start_real + (p->ts - h->start_mono);
+    sec = real / 1000000000;
+    localtime_r (&sec, &tm);
+    strftime (date, sizeof(date), "%Y-%m-%d %H:%M:%S", &tm);
+
+    printf ("%s.%03d,%lld,%u,%s,%u\n", date, (int)(real % 1000000000 / 1000000), (long long)p->ts,
+	    p->channel, p->type < sizeof(type_names) / sizeof(type_names[0]) ? type_names[p->type] : "?", p->value);
+  }
+
+  munmap (map, st.st_size);
+
+  return 0;
+}
@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "filter.h"
+
+/****************************************************************
+ * edge_filter_init (spec: comma separated stages/parameters)
+ ****************************************************************/
+
+int edge_filter_init(struct edge_filter *f, char *spec)
+{
+  char buf[128], *tok, *save;
+
+  memset(f, 0, sizeof(*f));
+  f->min_ms = FILTER_MIN_MS;
+  f->pct = FILTER_PCT;
+  f->ratio = FILTER_RATIO;
+
+  snprintf(buf, sizeof(buf), "%s", spec ? spec : FILTER_DEFAULT);
+
+  for (tok = strtok_r(buf, ",", &save) ; tok ; tok = strtok_r(NULL, ",", &save)) {
+    if (!strcmp(tok, "refractory"))
+      f->flags |= FILTER_REFRACTORY;
+    else if (!strcmp(tok, "outlier"))
+      f->flags |= FILTER_OUTLIER;
+    else if (!strcmp(tok, "rising"))
+      f->flags |= FILTER_RISING;
+    else if (!strcmp(tok, "none") || !strcmp(tok, "debounce"))
+      ;
+    else if (!strncmp(tok, "min=", 4))
+      f->min_ms = atoi(tok + 4);
+    else if (!strncmp(tok, "pct=", 4))
+      f->pct = atoi(tok + 4);
+    else if (!strncmp(tok, "ratio=", 6))
+      f->ratio = atoi(tok + 6);
+    else {
+      fprintf(stderr, "edge filter: unknown '%s'\n", tok);
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+/****************************************************************
+ * edge_filter_bpm (current estimate, 0 -> unknown)
+ ****************************************************************/
+
+void edge_filter_bpm(struct edge_filter *f, int bpm)
+{
+  f->iv = bpm > 0 ? 60000000000LL / bpm : 0;
+}
+
+/****************************************************************
+ * edge_filter_add
+ ****************************************************************/
+
+int edge_filter_add(struct edge_filter *f, struct gpio_edge *e)
+{
+  int lv = e->value ? 1 : 0;
+  int r = FILTER_EDGE | FILTER_BEAT;
+  int64_t dt;
+
+  // debounce
+  if (f->last && e->ts - f->last < (int64_t)f->min_ms * 1000000)
+    return FILTER_DROP;
+
+  // same level edges are one beat apart
+  dt = f->last_lv[lv] ? e->ts - f->last_lv[lv] : 0;
+
+  if (f->iv && dt) {
+    // refractory period: same level again too soon
+    if ((f->flags & FILTER_REFRACTORY) && dt * 100 < f->iv * f->pct)
+      return FILTER_DROP;
+
+    // interval ratio: extra beat, or missed beat(s)
+    if (f->flags & FILTER_OUTLIER) {
+      if (dt * 100 < f->iv * f->ratio) {
+	if (++f->nreject <= FILTER_MAX_REJECT)
+	  return FILTER_DROP;
+	f->iv = 0;
+	r |= FILTER_RESET;
+      }
+      else if (dt * 100 > f->iv * (200 - f->ratio))
+	r |= FILTER_GAP;
+    }
+  }
+
+  f->nreject = 0;
+  f->last = e->ts;
+  f->last_lv[lv] = e->ts;
+
+  if ((f->flags & FILTER_RISING) && !lv)
+    return FILTER_EDGE;
+
+  return r;
+}
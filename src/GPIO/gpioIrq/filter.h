@@ -0,0 +1,59 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <stdint.h>
+
+#include "gpio.h"
+
+/****************************************************************
+ * Sensor edge filter (between the sensor fd and the bpm estimator)
+ *
+ * Stages, selected per channel by a spec string (-E, or the 4th
+ * field of a gpioIrq -f config line), e.g. "refractory,outlier":
+ *
+ *  debounce    edges closer than min ms to the previous one are
+ *              noise (always on, min=<ms>, 20 ms as before)
+ *  refractory  no new edge of the same level before pct% of the
+ *              current beat interval (pct=<%>)
+ *  outlier     beat intervals far from the current one: < ratio%
+ *              is an extra beat (dropped), > (200-ratio)% means
+ *              missed beats (new interval chain from there)
+ *  rising      only rising edges count as beats
+ *  none        debounce only
+ *
+ * Before the bpm is known only the debounce applies. After
+ * FILTER_MAX_REJECT outliers in a row the rhythm really changed:
+ * FILTER_RESET asks the caller to restart the estimator (relock).
+ ****************************************************************/
+
+#define FILTER_REFRACTORY 0x1
+#define FILTER_OUTLIER    0x2
+#define FILTER_RISING     0x4
+
+#define FILTER_DEFAULT     "refractory,outlier"
+#define FILTER_MIN_MS      20
+#define FILTER_PCT         40
+#define FILTER_RATIO       60
+#define FILTER_MAX_REJECT  3
+
+/* edge_filter_add() result (bits) */
+#define FILTER_DROP  0x0   /* noise: ignore */
+#define FILTER_EDGE  0x1   /* real edge (copy it to the led) */
+#define FILTER_BEAT  0x2   /* feed it to the bpm estimator */
+#define FILTER_GAP   0x4   /* beat(s) missed before this one */
+#define FILTER_RESET 0x8   /* rhythm changed, restart the estimator */
+
+struct edge_filter {
+  int flags;
+  int min_ms, pct, ratio;
+  int64_t last;          /* last edge kept, ns */
+  int64_t last_lv[2];    /* same, per level */
+  int64_t iv;            /* current beat interval, ns (0 -> unknown) */
+  int nreject;           /* outliers in a row */
+};
+
+int edge_filter_init(struct edge_filter *f, char *spec);
+void edge_filter_bpm(struct edge_filter *f, int bpm);
+int edge_filter_add(struct edge_filter *f, struct gpio_edge *e);
+
+#endif /* FILTER_H */
@@ -0,0 +1,413 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+
+#include "gpio.h"
+#include "bcm_gpio.h"
+
+char *gpio_chip = NULL;            /* -c <gpiochip> */
+unsigned int gpio_debounce_us = 0; /* -d <us>, chardev only */
+int gpio_mmio = GPIO_MMIO_OFF;     /* -M / -F, outputs only */
+
+/****************************************************************
+ * gpio_export
+ ****************************************************************/
+int gpio_export(unsigned int gpio)
+{
+  int fd, len;
+  char buf[MAX_BUF];
+
+  fd = open(SYSFS_GPIO_DIR "/export", O_WRONLY);
+  if (fd < 0) {
+    perror("gpio/export");
+    return fd;
+  }
+
+  len = snprintf(buf, sizeof(buf), "%d", gpio);
+  write(fd, buf, len);
+  close(fd);
+
+  return 0;
+}
+
+/****************************************************************
+ * gpio_unexport
+ ****************************************************************/
+int gpio_unexport(unsigned int gpio)
+{
+  int fd, len;
+  char buf[MAX_BUF];
+
+  fd = open(SYSFS_GPIO_DIR "/unexport", O_WRONLY);
+  if (fd < 0) {
+    perror("gpio/export");
+    return fd;
+  }
+
+  len = snprintf(buf, sizeof(buf), "%d", gpio);
+  write(fd, buf, len);
+  close(fd);
+  return 0;
+}
+
+/****************************************************************
+ * gpio_set_dir
+ ****************************************************************/
+int gpio_set_dir(unsigned int gpio, unsigned int out_flag)
+{
+  int fd;
+  char buf[MAX_BUF];
+
+  snprintf(buf, sizeof(buf), SYSFS_GPIO_DIR  "/gpio%d/direction", gpio);
+
+  fd = open(buf, O_WRONLY);
+  if (fd < 0) {
+    perror("gpio/direction");
+    return fd;
+  }
+
+  if (out_flag)
+    write(fd, "out", 4);
+  else
+    write(fd, "in", 3);
+
+  close(fd);
+  return 0;
+}
+
+/****************************************************************
+ * gpio_set_edge
+ ****************************************************************/
+
+int gpio_set_edge(unsigned int gpio, char *edge)
+{
+  int fd;
+  char buf[MAX_BUF];
+
+  snprintf(buf, sizeof(buf), SYSFS_GPIO_DIR "/gpio%d/edge", gpio);
+
+  fd = open(buf, O_WRONLY);
+  if (fd < 0) {
+    perror("gpio/set-edge");
+    return fd;
+  }
+
+  write(fd, edge, strlen(edge) + 1);
+  close(fd);
+  return 0;
+}
+
+/****************************************************************
+ * gpio_fd_open
+ ****************************************************************/
+
+int gpio_fd_open(unsigned int gpio)
+{
+  int fd;
+  char buf[MAX_BUF];
+
+  snprintf(buf, sizeof(buf), SYSFS_GPIO_DIR "/gpio%d/value", gpio);
+
+  fd = open(buf, O_RDONLY | O_NONBLOCK );
+  if (fd < 0) {
+    perror("gpio/fd_open");
+  }
+  return fd;
+}
+
+/****************************************************************
+ * gpio_fd_close
+ ****************************************************************/
+
+int gpio_fd_close(int fd)
+{
+  return close(fd);
+}
+
+/****************************************************************
+ * gpio_timestamp (CLOCK_MONOTONIC in ns, same clock as the kernel
+ * edge timestamps)
+ ****************************************************************/
+
+int64_t gpio_timestamp(void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/****************************************************************
+ * gpio_chip_open (chardev)
+ ****************************************************************/
+
+static int gpio_chip_open(char *chip)
+{
+  int fd;
+  char buf[MAX_BUF];
+
+  if (*chip == '/')
+    snprintf(buf, sizeof(buf), "%s", chip);
+  else if (*chip >= '0' && *chip <= '9')
+    snprintf(buf, sizeof(buf), GPIO_DEV_DIR "/gpiochip%s", chip);
+  else
+    snprintf(buf, sizeof(buf), GPIO_DEV_DIR "/%s", chip);
+
+  fd = open(buf, O_RDWR | O_CLOEXEC);
+  if (fd < 0)
+    perror("gpio/chip_open");
+
+  return fd;
+}
+
+/****************************************************************
+ * gpio_line_request (chardev)
+ ****************************************************************/
+
+static int gpio_line_request(struct gpio_line *line, unsigned int out_flag, char *edge)
+{
+  struct gpio_v2_line_request req;
+  int chip_fd, n = 0;
+
+  chip_fd = gpio_chip_open(gpio_chip);
+  if (chip_fd < 0)
+    return chip_fd;
+
+  memset(&req, 0, sizeof(req));
+  req.offsets[0] = line->gpio;
+  req.num_lines = 1;
+  strncpy(req.consumer, "pyramidion", sizeof(req.consumer) - 1);
+
+  if (out_flag) {
+    req.config.flags = GPIO_V2_LINE_FLAG_OUTPUT;
+  }
+  else {
+    req.config.flags = GPIO_V2_LINE_FLAG_INPUT;
+    if (edge) {
+      if (strcmp(edge, "falling"))
+	req.config.flags |= GPIO_V2_LINE_FLAG_EDGE_RISING;
+      if (strcmp(edge, "rising"))
+	req.config.flags |= GPIO_V2_LINE_FLAG_EDGE_FALLING;
+      req.event_buffer_size = GPIO_EVENT_MAX;
+    }
+
+    if (gpio_debounce_us) {
+      req.config.attrs[n].attr.id = GPIO_V2_LINE_ATTR_ID_DEBOUNCE;
+      req.config.attrs[n].attr.debounce_period_us = gpio_debounce_us;
+      req.config.attrs[n].mask = 1;
+      n++;
+    }
+  }
+  req.config.num_attrs = n;
+
+  if (ioctl(chip_fd, GPIO_V2_GET_LINE_IOCTL, &req) < 0) {
+    perror("gpio/line_request");
+    close(chip_fd);
+    return -1;
+  }
+
+  /* the request fd stays valid without the chip fd */
+  close(chip_fd);
+
+  line->fd = req.fd;
+  line->chardev = 1;
+  line->events = POLLIN;
+
+  return 0;
+}
+
+/****************************************************************
+ * gpio_line_open
+ *
+ * Export the line, set direction (and edge for inputs) then open
+ * the value file once. The fd is also the one to poll() for edges.
+ * Outputs with gpio_mmio only set the pin function, no fd.
+ * gpio GPIO_NONE: no line, fd stays -1.
+ ****************************************************************/
+
+int gpio_line_open(struct gpio_line *line, int gpio, unsigned int out_flag, char *edge)
+{
+  char buf[MAX_BUF];
+
+  line->gpio = gpio;
+  line->fd = -1;
+  line->chardev = 0;
+  line->events = POLLPRI;
+  line->mmio = 0;
+
+  if (gpio < 0)
+    return 0;
+
+  if (out_flag && gpio_mmio) {
+    if (bcm_gpio_open(gpio_mmio == GPIO_MMIO_FAKE ? BCM_GPIO_FAKE : BCM_GPIO_HW) < 0)
+      return -1;
+    bcm_gpio_out(gpio);
+    line->mmio = 1;
+    return 0;
+  }
+
+  if (gpio_chip)
+    return gpio_line_request(line, out_flag, edge);
+
+  gpio_export(gpio);
+  gpio_set_dir(gpio, out_flag);
+  if (edge)
+    gpio_set_edge(gpio, edge);
+
+  snprintf(buf, sizeof(buf), SYSFS_GPIO_DIR "/gpio%d/value", gpio);
+
+  line->fd = open(buf, (out_flag ? O_RDWR : O_RDONLY) | O_NONBLOCK);
+  if (line->fd < 0) {
+    perror("gpio/line_open");
+    return line->fd;
+  }
+
+  return 0;
+}
+
+/****************************************************************
+ * gpio_line_set
+ ****************************************************************/
+
+int gpio_line_set(struct gpio_line *line, unsigned int value)
+{
+  struct gpio_v2_line_values lv;
+
+  if (line->mmio) {
+    bcm_gpio_write(line->gpio, value);
+    return 0;
+  }
+
+  if (line->fd < 0)
+    return 0;
+
+  if (line->chardev) {
+    lv.mask = 1;
+    lv.bits = value ? 1 : 0;
+    if (ioctl(line->fd, GPIO_V2_LINE_SET_VALUES_IOCTL, &lv) < 0) {
+      perror("gpio/set-value");
+      return -1;
+    }
+    return 0;
+  }
+
+  if (pwrite(line->fd, value ? "1" : "0", 1, 0) < 0) {
+    perror("gpio/set-value");
+    return -1;
+  }
+
+  return 0;
+}
+
+/****************************************************************
+ * gpio_line_get
+ ****************************************************************/
+
+int gpio_line_get(struct gpio_line *line, unsigned int *value)
+{
+  struct gpio_v2_line_values lv;
+  char ch;
+
+  if (line->mmio) {
+    *value = bcm_gpio_read(line->gpio);
+    return 0;
+  }
+
+  if (line->fd < 0)
+    return -1;
+
+  if (line->chardev) {
+    lv.mask = 1;
+    lv.bits = 0;
+    if (ioctl(line->fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &lv) < 0) {
+      perror("gpio/get-value");
+      return -1;
+    }
+    *value = lv.bits & 1;
+    return 0;
+  }
+
+  if (pread(line->fd, &ch, 1, 0) < 0) {
+    perror("gpio/get-value");
+    return -1;
+  }
+
+  *value = (ch != '0');
+
+  return 0;
+}
+
+/****************************************************************
+ * gpio_line_read_edges
+ *
+ * Return the edges pending on an input line (call after poll()).
+ * chardev: up to 'max' kernel events per read(), with the kernel
+ * timestamp. sysfs: one edge, timestamped now.
+ ****************************************************************/
+
+int gpio_line_read_edges(struct gpio_line *line, struct gpio_edge *edges, int max)
+{
+  struct gpio_v2_line_event ev[GPIO_EVENT_MAX];
+  char buf[MAX_BUF];
+  int i, len;
+
+  if (line->chardev) {
+    if (max > GPIO_EVENT_MAX)
+      max = GPIO_EVENT_MAX;
+
+    len = read(line->fd, ev, max * sizeof(ev[0]));
+    if (len < 0)
+      return len;
+
+    len /= sizeof(ev[0]);
+    for (i = 0 ; i < len ; i++) {
+      edges[i].ts = ev[i].timestamp_ns;
+      edges[i].value = (ev[i].id == GPIO_V2_LINE_EVENT_RISING_EDGE);
+    }
+    return len;
+  }
+
+  if (max < 1)
+    return 0;
+
+  len = pread(line->fd, buf, sizeof(buf), 0);
+  if (len < 0)
+    return len;
+
+  edges[0].ts = gpio_timestamp();
+  edges[0].value = (buf[0] != '0');
+
+  return 1;
+}
+
+/****************************************************************
+ * gpio_line_ack
+ *
+ * Consume the pending edge(s) after poll() so that the next edge
+ * can be reported (replaces the lseek() + read() pair).
+ ****************************************************************/
+
+int gpio_line_ack(struct gpio_line *line)
+{
+  struct gpio_edge edges[GPIO_EVENT_MAX];
+
+  return gpio_line_read_edges(line, edges, GPIO_EVENT_MAX);
+}
+
+/****************************************************************
+ * gpio_line_close
+ ****************************************************************/
+
+void gpio_line_close(struct gpio_line *line)
+{
+  if (line->fd >= 0)
+    close(line->fd);
+
+  line->fd = -1;
+}
@@ -0,0 +1,77 @@
+#ifndef GPIO_H
+#define GPIO_H
+
+#include <stdint.h>
+#include <poll.h>
+
+/****************************************************************
+ * Constants
+ ****************************************************************/
+
+#define SYSFS_GPIO_DIR "/sys/class/gpio"
+
+#define GPIO_DEV_DIR "/dev"
+
+#define MAX_BUF 64
+
+#define GPIO_EVENT_MAX     16   /* edges read at once (chardev) */
+
+/*
+ * GPIO line handle: the sysfs value file is opened once at startup and
+ * kept open for the process lifetime, so reading/writing a value is a
+ * single pread()/pwrite() at offset 0 (no path lookup, no open/close).
+ *
+ * If gpio_chip is set, lines are requested from /dev/gpiochipN (v2 uAPI)
+ * instead: 'gpio' is then the line offset on the chip, fd is the line
+ * request fd, edges are timestamped and debounced by the kernel.
+ *
+ * If gpio_mmio is set, output lines are driven through the mmap()ed
+ * BCM registers (common/bcm_gpio.c) instead: one store per change.
+ */
+struct gpio_line {
+  int gpio;      /* GPIO_NONE -> no line */
+  int fd;
+  int chardev;
+  short events;  /* poll() events to wait for */
+  int mmio;      /* output through bcm_gpio registers */
+};
+
+#define GPIO_NONE (-1)   /* pin not set (0 is a valid line offset) */
+
+#define GPIO_LINE_INIT { GPIO_NONE, -1, 0, POLLPRI, 0 }
+
+/* gpio_mmio values */
+#define GPIO_MMIO_OFF  0
+#define GPIO_MMIO_HW   1   /* -M */
+#define GPIO_MMIO_FAKE 2   /* -F, x86 tests */
+
+/* edge as reported by gpio_line_read_edges() */
+struct gpio_edge {
+  int64_t ts;       /* CLOCK_MONOTONIC, ns */
+  unsigned int value;
+};
+
+/* backend selection (NULL -> sysfs) */
+extern char *gpio_chip;
+extern unsigned int gpio_debounce_us;
+extern int gpio_mmio;
+
+/* sysfs helpers */
+int gpio_export(unsigned int gpio);
+int gpio_unexport(unsigned int gpio);
+int gpio_set_dir(unsigned int gpio, unsigned int out_flag);
+int gpio_set_edge(unsigned int gpio, char *edge);
+int gpio_fd_open(unsigned int gpio);
+int gpio_fd_close(int fd);
+
+int64_t gpio_timestamp(void);
+
+/* line handles */
+int gpio_line_open(struct gpio_line *line, int gpio, unsigned int out_flag, char *edge);
+int gpio_line_set(struct gpio_line *line, unsigned int value);
+int gpio_line_get(struct gpio_line *line, unsigned int *value);
+int gpio_line_ack(struct gpio_line *line);
+int gpio_line_read_edges(struct gpio_line *line, struct gpio_edge *edges, int max);
+void gpio_line_close(struct gpio_line *line);
+
+#endif /* GPIO_H */
@@ -5,302 +5,543 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <poll.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
 #include <signal.h>
 #include <time.h>
-#ifdef USE_MOSQUITTO
-#include <mosquitto.h>
-#endif
+
+#include "gpio.h"
+#include "trace.h"
+#include "beat.h"
+#include "filter.h"
+#include "telem.h"
+#include "beatlog.h"
+#include "sched.h"
+#include "mqtt.h"
+#include "rt.h"
 
 /****************************************************************
  * Constants
  ****************************************************************/
 
-#define SYSFS_GPIO_DIR "/sys/class/gpio"
-
 #define DEFAULT_BPM_IDLE   30 /* bpm = 60000 / 2 / timeout */
 #define MIN_BPM_IDLE       20
 #define MAX_BPM_IDLE       150
 #define BPM_IDLE_INC       10   /* press the button -> bpm_idle +/- 10 bpm */
 
-#define MAX_BUF 64
+#define MAX_EVENTS         16
+
+#ifdef USE_MOSQUITTO
+#define DEFAULT_TOPIC mqtt_topic  /* -T */
+#else
+#define DEFAULT_TOPIC NULL
+#endif
+
+/* epoll event source */
+#define SRC_SENSOR 0
+#define SRC_IDLE   1
+#define SRC_BTN    2
+#define SRC_SWITCH 3   /* auto/manual switch edge */
+#define SRC_SW_DEB 4   /* switch debounce timer */
+#define SRC_SCHED  5   /* schedule boundary */
+
+#define SWITCH_DEBOUNCE_MS 50
+
+struct channel;
+
+struct ev_src {
+  int type;
+  struct channel *ch;
+};
+
+/* sensor -> led channel (-i/-o/-T or one line of the -f config file) */
+struct channel {
+  int gpio_in, gpio_out;
+  char *topic;
+  struct gpio_line line_in, line_out;
+  int idle_fd;                         /* timerfd for default blinking */
+  unsigned int v_out;
+  int64_t ts_s, ts_s_diff;             /* last sensor edge (ms) */
+  struct ev_src src_in, src_idle;
+  struct trace trace;                  /* -R */
+  char *filter_spec;                   /* NULL -> -E one */
+  struct edge_filter filter;
+  struct bpm_est est;
+  struct telem_channel *tc;
+  int index, mode;                     /* beat log */
+  int64_t beat_ts;                     /* last beat / idle blink (ns), MQTT binary */
+  int64_t sensor_beat;                 /* last sensor beat (ns), 0 -> none (-e) */
+};
 
 /* global variables */
-int gpio_in = 0;  /* sensor */
-int gpio_out = 0; /* led */
-int gpio_btn = 0; /* button */
-int count_in = 0;
+int gpio_in = GPIO_NONE;  /* sensor */
+int gpio_out = GPIO_NONE; /* led */
+int gpio_btn = GPIO_NONE; /* button */
+struct gpio_line line_btn = GPIO_LINE_INIT;
+struct channel *channels;
+int nchannels;
+int epoll_fd;
 time_t t_btn, t_btn_old;
 int bpm_idle;
 int verbose;
-
-// SysTimestamp() emulation
-int64_t timespec_as_milliseconds(struct timespec ts)
+int rt_lock = 0, rt_prio = 0, rt_cpu = -1;
+struct telem *telem;                  /* /dev/shm/pyramidion-gpioIrq */
+struct telem_channel telem_spare;     /* channels >= TELEM_CHANNELS */
+struct beatlog beatlog;               /* -L <dir> */
+char *beatlog_dir;
+char *filter_spec = FILTER_DEFAULT;   /* -E */
+
+/* master mode (-G / -S): channels run while the switch is on or inside
+   the schedule, instead of starting/stopping the service */
+int gpio_switch = GPIO_NONE;
+struct gpio_line line_switch = GPIO_LINE_INIT;
+int switch_fd = -1, sched_fd = -1;
+struct sched sched = { -1, 0 };
+int switch_on, sched_on;
+int active = 1;
+
+// SysTimestamp() emulation (CLOCK_MONOTONIC, same clock as edge timestamps)
+int64_t sysTimestamp()
 {
-    int64_t rv = ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
-    return rv;
+  return gpio_timestamp() / 1000000;
 }
 
-int64_t sysTimestamp()
+#ifdef USE_MOSQUITTO
+// bpm -> ch->topic, ASCII or binary (-W, common/wire.h)
+void channel_send (struct channel *ch, int bpm)
 {
-  struct timespec ts;
+  int mqtt_err = mqtt_send_bpm (ch->topic, ch->index, bpm, ch->beat_ts);
 
-  clock_gettime (CLOCK_REALTIME, &ts);
-
-  return timespec_as_milliseconds(ts);
+  if (mqtt_err != 0) {
+    fprintf(stderr, "mqtt_send error= %d\n", mqtt_err);
+    telem_begin (telem);
+    telem->mqtt_errors++;
+    telem_end (telem);
+  }
 }
 
-#ifdef USE_MOSQUITTO
+// -e: one event per sensor beat, ibi_ns 0 if unknown (see wire.h)
+void channel_send_beat (struct channel *ch, int bpm, int64_t beat_ns, int64_t ibi_ns)
+{
+  int mqtt_err = mqtt_send_beat (ch->topic, ch->index, bpm, beat_ns, ibi_ns);
 
-/************
- * MQTT
- ************/
+  if (mqtt_err != 0) {
+    fprintf(stderr, "mqtt_send error= %d\n", mqtt_err);
+    telem_begin (telem);
+    telem->mqtt_errors++;
+    telem_end (telem);
+  }
+}
+#endif
 
-struct mosquitto *mosq = NULL;
-char *topic = NULL;
-char *mqtt_host = NULL;
-char *mqtt_topic = NULL;
+/****************************************************************
+ * channel_add
+ ****************************************************************/
 
-void mosq_log_callback(struct mosquitto *mosq, void *userdata, int level, const char *str)
+struct channel *channel_add (int in, int out, char *topic)
 {
-  /* Pring all log messages regardless of level. */
-  
-  switch(level){
-    //case MOSQ_LOG_DEBUG:
-    //case MOSQ_LOG_INFO:
-    //case MOSQ_LOG_NOTICE:
-  case MOSQ_LOG_WARNING:
-  case MOSQ_LOG_ERR: {
-    printf("%i:%s\n", level, str);
-  }
+  struct channel *ch;
+
+  channels = realloc (channels, (nchannels + 1) * sizeof(*channels));
+  if (!channels) {
+    perror ("realloc");
+    exit (1);
   }
+
+  ch = &channels[nchannels++];
+  memset (ch, 0, sizeof(*ch));
+  ch->gpio_in = in;
+  ch->gpio_out = out;
+  ch->topic = topic;
+
+  return ch;
 }
 
-void mqtt_setup()
-{
-  int port = 1883;
-  int keepalive = 60;
-  bool clean_session = true;
+/****************************************************************
+ * channels_load
+ *
+ * Config file: one channel per line
+ *   <gpio-in> <gpio-out> [mqtt-topic [edge-filter]]
+ * '#' starts a comment, the default topic is the -T one ('-' too),
+ * the default filter the -E one (see filter.h)
+ ****************************************************************/
 
-  if (!mqtt_host || !mqtt_topic) 
-    return;
-  
-  mosquitto_lib_init();
-  mosq = mosquitto_new(NULL, clean_session, NULL);
-  if(!mosq){
-    fprintf(stderr, "Error: Out of memory.\n");
-    mqtt_host = 0;
-    return;
-    //    exit(1);
-  }
-  
-  mosquitto_log_callback_set(mosq, mosq_log_callback);
-  
-  if(mosquitto_connect(mosq, mqtt_host, port, keepalive)){
-    fprintf(stderr, "Unable to connect.\n");
-    mqtt_host = 0;
-    return;
-    //    exit(1);
+int channels_load (char *file)
+{
+  FILE *f;
+  char line[256], topic[128], spec[128];
+  struct channel *ch;
+  unsigned int in, out;
+  int n;
+
+  if ((f = fopen (file, "r")) == NULL) {
+    perror (file);
+    return -1;
   }
 
-  int loop = mosquitto_loop_start(mosq);
+  while (fgets (line, sizeof(line), f)) {
+    if (*line == '#')
+      continue;
 
-  if(loop != MOSQ_ERR_SUCCESS){
-    fprintf(stderr, "Unable to start loop: %i\n", loop);
-    mqtt_host = 0;
-    return;
-    //    exit(1);
+    n = sscanf (line, "%u %u %127s %127s", &in, &out, topic, spec);
+    if (n < 2)
+      continue;
+
+    ch = channel_add (in, out, n >= 3 && strcmp (topic, "-") ? strdup (topic) : DEFAULT_TOPIC);
+    if (n == 4)
+      ch->filter_spec = strdup (spec);
   }
-}
 
-int mqtt_send(char *msg)
-{
-  if (!mqtt_host || !mqtt_topic) 
-    return 0;
+  fclose (f);
 
-  return mosquitto_publish(mosq, NULL, mqtt_topic, strlen(msg), msg, 0, 0);
+  return nchannels;
 }
 
-#endif /* USE_MOSQUITTO */
-
 /****************************************************************
- * gpio_export
+ * channel_idle_arm (default blinking period from bpm_idle)
+ *
+ * Also called on each sensor edge: the first tick comes one period
+ * after the last edge, like the poll() timeout of the old loop.
  ****************************************************************/
-int gpio_export(unsigned int gpio)
-{
-  int fd, len;
-  char buf[MAX_BUF];
 
-  fd = open(SYSFS_GPIO_DIR "/export", O_WRONLY);
-  if (fd < 0) {
-    perror("gpio/export");
-    return fd;
+void channel_idle_arm (struct channel *ch)
+{
+  struct itimerspec its;
+  int timeout = 30000 / bpm_idle;
+
+  // stopped (master mode) -> no timer, no wakeup
+  memset (&its, 0, sizeof(its));
+  if (active) {
+    its.it_interval.tv_sec = timeout / 1000;
+    its.it_interval.tv_nsec = (timeout % 1000) * 1000000;
+    its.it_value = its.it_interval;
   }
 
-  len = snprintf(buf, sizeof(buf), "%d", gpio);
-  write(fd, buf, len);
-  close(fd);
-
-  return 0;
+  if (timerfd_settime (ch->idle_fd, 0, &its, NULL) < 0)
+    perror ("timerfd_settime");
 }
 
 /****************************************************************
- * gpio_unexport
+ * epoll_add
  ****************************************************************/
-int gpio_unexport(unsigned int gpio)
+
+void epoll_add (int fd, unsigned int events, struct ev_src *src)
 {
-  int fd, len;
-  char buf[MAX_BUF];
+  struct epoll_event ev;
 
-  fd = open(SYSFS_GPIO_DIR "/unexport", O_WRONLY);
-  if (fd < 0) {
-    perror("gpio/export");
-    return fd;
-  }
+  ev.events = events;
+  ev.data.ptr = src;
 
-  len = snprintf(buf, sizeof(buf), "%d", gpio);
-  write(fd, buf, len);
-  close(fd);
-  return 0;
+  if (epoll_ctl (epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0)
+    perror ("epoll_ctl");
 }
 
 /****************************************************************
- * gpio_set_dir
+ * channel_open
  ****************************************************************/
-int gpio_set_dir(unsigned int gpio, unsigned int out_flag)
+
+void channel_open (struct channel *ch)
 {
-  int fd;
-  char buf[MAX_BUF];
+  // GPIO in (sensor)
+  gpio_line_open(&ch->line_in, ch->gpio_in, 0, "both");
 
-  snprintf(buf, sizeof(buf), SYSFS_GPIO_DIR  "/gpio%d/direction", gpio);
+  // GPIO out
+  gpio_line_open(&ch->line_out, ch->gpio_out, 1, NULL);
 
-  fd = open(buf, O_WRONLY);
-  if (fd < 0) {
-    perror("gpio/direction");
-    return fd;
+  if ((ch->idle_fd = timerfd_create (CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0) {
+    perror ("timerfd_create");
+    exit (1);
   }
+  channel_idle_arm (ch);
 
-  if (out_flag)
-    write(fd, "out", 4);
-  else
-    write(fd, "in", 3);
+  // POLLPRI/POLLIN have the same value as EPOLLPRI/EPOLLIN
+  ch->src_in.type = SRC_SENSOR;
+  ch->src_in.ch = ch;
+  epoll_add (ch->line_in.fd, ch->line_in.events, &ch->src_in);
 
-  close(fd);
-  return 0;
+  ch->src_idle.type = SRC_IDLE;
+  ch->src_idle.ch = ch;
+  epoll_add (ch->idle_fd, EPOLLIN, &ch->src_idle);
 }
 
 /****************************************************************
- * gpio_set_value
+ * channel_est_init (bpm estimator, after the filter)
  ****************************************************************/
-int gpio_set_value(unsigned int gpio, unsigned int value)
+
+void channel_est_init (struct channel *ch)
 {
-  int fd;
-  char buf[MAX_BUF];
+  bpm_est_init (&ch->est, BEAT_MIN);
+  if (ch->filter.flags & FILTER_RISING)
+    ch->est.step = 1;
+  edge_filter_bpm (&ch->filter, 0);
+  ch->sensor_beat = 0;
+}
 
-  if (!gpio)
-    return 0;
+/****************************************************************
+ * channel_sensor (edges on the sensor line -> filter -> estimator)
+ ****************************************************************/
 
-  snprintf(buf, sizeof(buf), SYSFS_GPIO_DIR "/gpio%d/value", gpio);
+void channel_sensor (struct channel *ch)
+{
+  struct gpio_edge edges[GPIO_EVENT_MAX];
+  int64_t ts_s_old;
+  int i, n, b, r, bpm, copied = 0, dropped = 0;
+
+  n = gpio_line_read_edges(&ch->line_in, edges, GPIO_EVENT_MAX);
+  if (n < 0)
+    perror ("read / sensor");
+
+  if (!active)
+    return;
+
+  // only this loop writes the channel telemetry: trace, led, beat log
+  // and MQTT run outside of the write section, the counters go at the end
+  bpm = ch->tc->bpm;
+
+  // edge timestamps come from the kernel with chardev (-c)
+  for (i = 0 ; i < n ; i++) {
+    trace_write (&ch->trace, &edges[i]);
+
+    ts_s_old = ch->ts_s;
+    ch->ts_s = edges[i].ts / 1000000;
+    ch->ts_s_diff = ch->ts_s - ts_s_old;
+	
+    if (verbose) 
+      printf ("Copy sensor value %d to GPIO %d (%lld)\n", ch->v_out, ch->gpio_out, (long long)ch->ts_s_diff);
+
+    r = edge_filter_add (&ch->filter, &edges[i]);
+    if (r == FILTER_DROP) {
+      dropped++;
+      beatlog_add (&beatlog, BEATLOG_DROP, ch->index, edges[i].value, edges[i].ts);
+      continue;
+    }
+
+    // copy the value to GPIO/out
+    gpio_line_set (&ch->line_out, ch->v_out);
+    ch->v_out = (ch->v_out == 0 ? 1 : 0);
+    copied = 1;
+
+    if (ch->mode != BEATLOG_MODE_SENSOR) {
+      ch->mode = BEATLOG_MODE_SENSOR;
+      beatlog_add (&beatlog, BEATLOG_MODE, ch->index, ch->mode, edges[i].ts);
+    }
+    beatlog_add (&beatlog, BEATLOG_EDGE, ch->index, edges[i].value, edges[i].ts);
 
-  fd = open(buf, O_WRONLY);
-  if (fd < 0) {
-    perror("gpio/set-value");
-    return fd;
+    if (r & FILTER_RESET)
+      channel_est_init (ch);
+    if (!(r & FILTER_BEAT))
+      continue;
+
+    b = bpm_est_add (&ch->est, (r & FILTER_GAP) ? -edges[i].ts : edges[i].ts);
+    edge_filter_bpm (&ch->filter, b);
+    if (b != bpm)
+      beatlog_add (&beatlog, BEATLOG_BPM, ch->index, b, edges[i].ts);
+    bpm = b;
+
+    // both edges feed the estimator, the beat itself is the rising
+    // one (led on): phase reference and beat events
+    if (!edges[i].value)
+      continue;
+
+    ch->beat_ts = edges[i].ts;
+
+#ifdef USE_MOSQUITTO
+    // the beats as they happen, the slave predicts the next ones
+    channel_send_beat (ch, b, edges[i].ts,
+		       (ch->sensor_beat && !(r & FILTER_GAP)) ? edges[i].ts - ch->sensor_beat : 0);
+#endif
+    ch->sensor_beat = edges[i].ts;
   }
 
-  if (value)
-    write(fd, "1", 2);
-  else
-    write(fd, "0", 2);
+  telem_begin (telem);
+  ch->tc->edges += n > 0 ? n : 0;
+  ch->tc->dropped += dropped;
+  ch->tc->bpm = bpm;
+  telem_end (telem);
 
-  close(fd);
-  return 0;
+  // the sensor drives the led: the idle timer restarts from its last edge
+  if (copied)
+    channel_idle_arm (ch);
 }
 
 /****************************************************************
- * gpio_get_value
+ * channel_idle (idle timer -> default blinking)
  ****************************************************************/
-int gpio_get_value(unsigned int gpio, unsigned int *value)
+
+void channel_idle (struct channel *ch)
 {
-  int fd;
-  char buf[MAX_BUF];
-  char ch;
+  uint64_t ticks;
+  int64_t ts_i;
 
-  snprintf(buf, sizeof(buf), SYSFS_GPIO_DIR "/gpio%d/value", gpio);
+  if (read (ch->idle_fd, &ticks, sizeof(ticks)) < 0 || !active)
+    return;
 
-  fd = open(buf, O_RDONLY);
-  if (fd < 0) {
-    perror("gpio/get-value");
-    return fd;
-  }
+  ts_i = sysTimestamp();
 
-  read(fd, &ch, 1);
+  if (ch->ts_s_diff < 20 || (ts_i - ch->ts_s > 3000)) {
+    if (verbose)
+      printf ("Idle activated on GPIO %d (%lld) !\n", ch->gpio_out, (long long)(ts_i-ch->ts_s));
 
-  if (ch != '0') {
-    *value = 1;
-  } else {
-    *value = 0;
-  }
+#ifdef USE_MOSQUITTO
+    // queued, only published if changed (or heartbeat)
+    channel_send (ch, 30);
+#endif
 
-  close(fd);
-  return 0;
-}
+    telem_begin (telem);
+    ch->tc->timeouts++;
+    telem_end (telem);
+
+    // sensor lost: restart the bpm estimation
+    if (ch->tc->bpm) {
+      channel_est_init (ch);
+      telem_begin (telem);
+      ch->tc->bpm = 0;
+      telem_end (telem);
+      beatlog_add (&beatlog, BEATLOG_BPM, ch->index, 0, ts_i * 1000000);
+    }
 
+    if (ch->mode != BEATLOG_MODE_IDLE) {
+      ch->mode = BEATLOG_MODE_IDLE;
+      beatlog_add (&beatlog, BEATLOG_MODE, ch->index, ch->mode, ts_i * 1000000);
+    }
+
+    // the blink beats when the led goes on (phase reference)
+    if (ch->v_out)
+      ch->beat_ts = ts_i * 1000000;
+    gpio_line_set (&ch->line_out, ch->v_out);
+    ch->v_out = (ch->v_out == 0 ? 1 : 0);
+  }
+  else {
+    if (verbose)
+      printf ("Idle ignored on GPIO %d (%lld) !\n", ch->gpio_out, (long long)(ts_i-ch->ts_s));
+  }
+}
 
 /****************************************************************
- * gpio_set_edge
+ * master_update
+ *
+ * Master mode: start/stop the channels in memory. Each start is a new
+ * session, thus a new beat log (-L).
  ****************************************************************/
 
-int gpio_set_edge(unsigned int gpio, char *edge)
+void master_update (void)
 {
-  int fd;
-  char buf[MAX_BUF];
+  int i, on = switch_on || sched_on;
+  if (on == active)
+    return;
 
-  snprintf(buf, sizeof(buf), SYSFS_GPIO_DIR "/gpio%d/edge", gpio);
+  active = on;
+  if (verbose)
+    printf ("%s (%s)\n", on ? "Started" : "Stopped", switch_on ? "manual" : sched_on ? "auto" : "off");
 
-  fd = open(buf, O_WRONLY);
-  if (fd < 0) {
-    perror("gpio/set-edge");
-    return fd;
+  if (on && beatlog_dir) {
+    beatlog_close (&beatlog);
+    beatlog_open (&beatlog, beatlog_dir);
   }
 
-  write(fd, edge, strlen(edge) + 1);
-  close(fd);
-  return 0;
+  for (i = 0 ; i < nchannels ; i++) {
+    struct channel *ch = &channels[i];
+
+    channel_idle_arm (ch);
+    ch->mode = on ? BEATLOG_MODE_IDLE : BEATLOG_MODE_OFF;
+    beatlog_add (&beatlog, BEATLOG_MODE, ch->index, ch->mode, gpio_timestamp());
+
+    if (!on) {
+      gpio_line_set (&ch->line_out, 0);
+      ch->v_out = 0;
+      channel_est_init (ch);
+      telem_begin (telem);
+      ch->tc->bpm = 0;
+      telem_end (telem);
+    }
+
+#ifdef USE_MOSQUITTO
+    // same messages as a service start / stop
+    channel_send (ch, on ? bpm_idle : 30);
+#endif
+  }
 }
 
 /****************************************************************
- * gpio_fd_open
+ * master_open (switch line, debounce and schedule timers)
  ****************************************************************/
 
-int gpio_fd_open(unsigned int gpio)
+void master_open (struct ev_src *src_switch, struct ev_src *src_deb, struct ev_src *src_sched)
 {
-  int fd;
-  char buf[MAX_BUF];
+  unsigned int v;
 
-  snprintf(buf, sizeof(buf), SYSFS_GPIO_DIR "/gpio%d/value", gpio);
+  if (gpio_switch >= 0) {
+    gpio_line_open (&line_switch, gpio_switch, 0, "both");
+    if ((switch_fd = timerfd_create (CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0) {
+      perror ("timerfd_create");
+      exit (1);
+    }
+    src_switch->type = SRC_SWITCH;
+    src_deb->type = SRC_SW_DEB;
+    epoll_add (line_switch.fd, line_switch.events, src_switch);
+    epoll_add (switch_fd, EPOLLIN, src_deb);
+
+    // level 0 -> manual on (as pyramidion-button.sh)
+    if (gpio_line_get (&line_switch, &v) == 0)
+      switch_on = (v == 0);
+  }
 
-  fd = open(buf, O_RDONLY | O_NONBLOCK );
-  if (fd < 0) {
-    perror("gpio/fd_open");
+  if (sched.start >= 0) {
+    if ((sched_fd = timerfd_create (CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC)) < 0) {
+      perror ("timerfd_create");
+      exit (1);
+    }
+    src_sched->type = SRC_SCHED;
+    epoll_add (sched_fd, EPOLLIN, src_sched);
+    sched_on = sched_active (&sched, time (0));
+    sched_arm (&sched, sched_fd);
   }
-  return fd;
+
+  master_update ();
 }
 
 /****************************************************************
- * gpio_fd_close
+ * master_event
  ****************************************************************/
 
-int gpio_fd_close(int fd)
+void master_event (int type)
 {
-  return close(fd);
+  struct itimerspec its;
+  uint64_t ticks;
+  unsigned int v;
+
+  switch (type) {
+  // switch edge: read the level once it settled
+  case SRC_SWITCH:
+    gpio_line_ack (&line_switch);
+    memset (&its, 0, sizeof(its));
+    its.it_value.tv_nsec = SWITCH_DEBOUNCE_MS * 1000000;
+    timerfd_settime (switch_fd, 0, &its, NULL);
+    return;
+
+  case SRC_SW_DEB:
+    if (read (switch_fd, &ticks, sizeof(ticks)) < 0 || gpio_line_get (&line_switch, &v) < 0)
+      return;
+    switch_on = (v == 0);
+    break;
+
+  // boundary, or clock set (ECANCELED): re-evaluate and re-arm
+  case SRC_SCHED:
+    read (sched_fd, &ticks, sizeof(ticks));
+    sched_on = sched_active (&sched, time (0));
+    sched_arm (&sched, sched_fd);
+    break;
+  }
+
+  master_update ();
 }
 
 void usage (void)
 {
 #ifdef USE_MOSQUITTO
-  printf("\t-i <gpio-in-pin>\n\t-o <gpio-out-pin> \n\t-g <btn-gpio>\n\t-h <mqtt_host>\n\t-T <mqtt_topic> \n\t-v verbose \n\t-b <idle-bpm>\n\t-w <time> (wait 'time' before sending bpm)\n\n");
+  printf("\t-i <gpio-in-pin>\n\t-o <gpio-out-pin> \n\t-f <config> (<gpio-in> <gpio-out> [topic [filter]] per line)\n\t-g <btn-gpio>\n\t-R <trace> (record sensor edges)\n\t-L <dir> (beat log, one file per session)\n\t-E <filter> (edge filter, default " FILTER_DEFAULT ")\n\t-G <switch-gpio> (master: auto/manual switch)\n\t-S <HH:MM-HH:MM> (master: schedule)\n\t-c <gpiochip> (use chardev, pins are line offsets)\n\t-d <debounce-us> (chardev)\n\t-h <mqtt_host>\n\t-T <mqtt_topic> \n\t-H <sec> (mqtt heartbeat, default on change only)\n\t-B <topic> (batch updates on one topic)\n\t-W (binary bpm messages, see wire.h)\n\t-e (binary + one message per beat)\n\t-M (led through mmap()ed registers)\n\t-F (fake registers, tests)\n\t-m (mlockall)\n\t-r <fifo-prio>\n\t-a <cpu>\n\t-v verbose \n\t-b <idle-bpm>\n\n");
 #else  
-  printf("\t-i <gpio-in-pin>\n\t-o <gpio-out-pin> \n\t-g <btn-gpio>\n\t-v verbose \n\t-b <idle-bpm>\n\t-w <time> (wait 'time' before sending bpm)\n\n");
+  printf("\t-i <gpio-in-pin>\n\t-o <gpio-out-pin> \n\t-f <config> (<gpio-in> <gpio-out> [- [filter]] per line)\n\t-g <btn-gpio>\n\t-R <trace> (record sensor edges)\n\t-L <dir> (beat log, one file per session)\n\t-E <filter> (edge filter, default " FILTER_DEFAULT ")\n\t-G <switch-gpio> (master: auto/manual switch)\n\t-S <HH:MM-HH:MM> (master: schedule)\n\t-c <gpiochip> (use chardev, pins are line offsets)\n\t-d <debounce-us> (chardev)\n\t-M (led through mmap()ed registers)\n\t-F (fake registers, tests)\n\t-m (mlockall)\n\t-r <fifo-prio>\n\t-a <cpu>\n\t-v verbose \n\t-b <idle-bpm>\n\n");
 #endif
   
   exit (1);
@@ -309,8 +550,14 @@ void usage (void)
 // signal handler
 static void got_exit (int sig)
 {
+  int i;
+
   /* Clear gpio out before exiting */
-  gpio_set_value (gpio_out, 0);
+  for (i = 0 ; i < nchannels ; i++) {
+    gpio_line_set (&channels[i].line_out, 0);
+    trace_close (&channels[i].trace);
+  }
+  beatlog_close (&beatlog);
 
   printf ("Got signal, exiting !\n");
   exit (0);
@@ -322,19 +569,16 @@ static void got_exit (int sig)
  ****************************************************************/
 int main(int ac, char **av)
 {
-  struct pollfd fdset[2];
-  int nfds = 2;
-  int gpio_fd, gpio_btn_fd, timeout, rc;
-  char buf[MAX_BUF], *cp;
-  unsigned int v_out = 0;
+  struct epoll_event events[MAX_EVENTS];
+  struct ev_src src_btn, src_switch, src_deb, src_sched;
+  struct ev_src *src;
+  int rc;
+  char *cp, *config = NULL, *trace_file = NULL;
+  char trace_name[256];
+  int i, j;
   int exit_v = 0;
   int skip_btn_event = 1;
   int bpm_inc = BPM_IDLE_INC;
-  int64_t ts_i = 0, ts_s = 0, ts_s_old = 0, ts_s_diff = 0;
-#ifdef USE_MOSQUITTO  
-  int mqtt_err;
-  char mqtt_msg[MAX_BUF];
-#endif  
 
   bpm_idle = DEFAULT_BPM_IDLE;
   
@@ -360,16 +604,80 @@ int main(int ac, char **av)
 	gpio_out = atoi(*++av);
 	break;
 
+      case 'f' :
+	config = *++av;
+	break;
+
+      case 'R' :
+	trace_file = *++av;
+	break;
+
+      case 'L' :
+	beatlog_dir = *++av;
+	break;
+
+      case 'E' :
+	filter_spec = *++av;
+	break;
+
+      case 'G' :
+	gpio_switch = atoi(*++av);
+	break;
+
+      case 'S' :
+	if (sched_parse (&sched, *++av) < 0)
+	  usage();
+	break;
+
 #ifdef USE_MOSQUITTO	
       case 'T' :
 	mqtt_topic = *++av;
 	break;
+
+      case 'H' :
+	mqtt_heartbeat = atoi(*++av) * 1000;
+	break;
+
+      case 'B' :
+	mqtt_batch_topic = *++av;
+	break;
+
+      case 'W' :
+	mqtt_wire = MQTT_WIRE_BINARY;
+	break;
+
+      case 'e' :
+	mqtt_wire = MQTT_WIRE_BEATS;
+	break;
 #endif	
 
       case 'b' :
 	bpm_idle = atoi(*++av);
 	break;
 
+      case 'c' :
+	gpio_chip = *++av;
+	break;
+
+      case 'd' :
+	gpio_debounce_us = atoi(*++av);
+	break;
+
+      case 'M' :
+	gpio_mmio = GPIO_MMIO_HW; break;
+
+      case 'F' :
+	gpio_mmio = GPIO_MMIO_FAKE; break;
+
+      case 'm' :
+	rt_lock = 1; break;
+
+      case 'r' :
+	rt_prio = atoi(*++av); break;
+
+      case 'a' :
+	rt_cpu = atoi(*++av); break;
+
       case 'v' :
 	verbose = 1; break;
 
@@ -381,29 +689,54 @@ int main(int ac, char **av)
       break;
   }
 
-  if (!gpio_in || !gpio_out)
-    usage();
+  if (config) {
+    if (channels_load (config) <= 0)
+      usage();
+  }
+  else {
+    if (gpio_in < 0 || gpio_out < 0)
+      usage();
+    channel_add (gpio_in, gpio_out, DEFAULT_TOPIC);
+  }
 
-  timeout = 30000 / bpm_idle;
-  
-  // GPIO in (sensor)
-  gpio_export(gpio_in);
-  gpio_set_dir(gpio_in, 0);
-  gpio_set_edge(gpio_in, "both");
-  gpio_fd = gpio_fd_open(gpio_in);
+  if ((epoll_fd = epoll_create1 (EPOLL_CLOEXEC)) < 0) {
+    perror ("epoll_create1");
+    exit (1);
+  }
 
-  // GPIO out
-  if (gpio_out) {
-    gpio_export(gpio_out);
-    gpio_set_dir(gpio_out, 1);
+  telem = telem_open ("gpioIrq", nchannels);
+
+  // mapped + prefaulted before mlockall()
+  if (beatlog_dir)
+    beatlog_open (&beatlog, beatlog_dir);
+
+  for (i = 0 ; i < nchannels ; i++) {
+    channels[i].tc = (i < TELEM_CHANNELS ? &telem->ch[i] : &telem_spare);
+    channels[i].tc->gpio_in = channels[i].gpio_in;
+    channels[i].tc->gpio_out = channels[i].gpio_out;
+    if (edge_filter_init (&channels[i].filter, channels[i].filter_spec ? channels[i].filter_spec : filter_spec) < 0)
+      usage();
+    channel_est_init (&channels[i]);
+    channels[i].index = i;
+    channels[i].mode = BEATLOG_MODE_IDLE;
+    channel_open (&channels[i]);
+
+    // record sensor edges: <file> for the first channel, <file>.<n> next
+    if (trace_file) {
+      if (i == 0)
+	snprintf (trace_name, sizeof(trace_name), "%s", trace_file);
+      else
+	snprintf (trace_name, sizeof(trace_name), "%s.%d", trace_file, i);
+      trace_open_write (&channels[i].trace, trace_name);
+    }
   }
 
   // GPIO button (in)
-  if (gpio_btn) {
-    gpio_export(gpio_btn);
-    gpio_set_dir(gpio_btn, 0);
-    gpio_set_edge(gpio_btn, "falling");
-    gpio_btn_fd = gpio_fd_open(gpio_btn);
+  gpio_line_open(&line_btn, gpio_btn, 0, "falling");
+  if (gpio_btn >= 0) {
+    src_btn.type = SRC_BTN;
+    src_btn.ch = NULL;
+    epoll_add (line_btn.fd, line_btn.events, &src_btn);
   }
 
   signal (SIGINT, got_exit);
@@ -411,67 +744,50 @@ int main(int ac, char **av)
 
 #ifdef USE_MOSQUITTO
   mqtt_setup();
-  sprintf (buf, "%d", bpm_idle);
-  mqtt_err = mqtt_send (buf);
-  if (mqtt_err != 0) 
-    fprintf(stderr, "mqtt_send error= %d\n", mqtt_err);
+  for (i = 0 ; i < nchannels ; i++)
+    channel_send (&channels[i], bpm_idle);
 #endif
 
+  // master mode: starts stopped outside the schedule / switch off
+  if (gpio_switch >= 0 || sched.start >= 0)
+    master_open (&src_switch, &src_deb, &src_sched);
+
+  // RT setup after the MQTT thread is started (it stays SCHED_OTHER),
+  // the epoll loop (all channels, this thread) gets SCHED_FIFO + CPU pinning
+  rt_setup (rt_lock, rt_prio, rt_cpu);
+
   if (verbose)
-    printf ("default blinking= %d bpm\n", bpm_idle);
+    printf ("%d channel(s), default blinking= %d bpm\n", nchannels, bpm_idle);
   
   while (1) {
-    memset((void*)fdset, 0, sizeof(fdset));
-
-    fdset[0].fd = gpio_fd;
-    fdset[0].events = POLLPRI;
+    // wait on fds (sensors, idle timers, button), O(1) dispatch per event
+    rc = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
 
-    if (gpio_btn) {
-      fdset[1].fd = gpio_btn_fd;
-      fdset[1].events = POLLPRI;
+    if (rc < 0) {
+      if (errno == EINTR)
+	continue;
+      perror ("epoll_wait");
+      exit_v = -1;
+      break;
     }
 
-    // wait on fds
-    rc = poll(fdset, nfds, timeout);
+    for (i = 0 ; i < rc ; i++) {
+      src = events[i].data.ptr;
 
-    if (rc < 0) {
-      perror ("poll");
-#ifdef USE_MOSQUITTO      
-      mqtt_err = mqtt_send ("30");
-      if (mqtt_err != 0) 
-	fprintf(stderr, "mqtt_send error= %d\n", mqtt_err);
-      return -1;
-#endif      
-    }
-    // rc > 0 => something happened on fds (sensor or button)
-    else if (rc > 0) {
+      switch (src->type) {
       // Sensor
-      if (fdset[0].revents & POLLPRI) {
-	lseek(fdset[0].fd, 0, SEEK_SET);
-	if (read(fdset[0].fd, buf, MAX_BUF) < 0)
-	  perror ("read / sensor");
-
-	//told = t;
-	//	clock_gettime (CLOCK_REALTIME, &tr);
-	//	t = (tr.tv_sec * 1000000000) + tr.tv_nsec;    
-
-	ts_s_old = ts_s;
-	ts_s = sysTimestamp();
-	ts_s_diff = ts_s - ts_s_old;
-	
-	if (verbose) 
-	  printf ("Copy sensor value %d to GPIO %d (%lld)\n", v_out, gpio_out, ts_s_diff);
-	
-	// copy the value to GPIO/out
-	if (ts_s_diff > 20) {
-	  gpio_set_value (gpio_out, v_out);
-	  v_out = (v_out == 0 ? 1 : 0);
-	}
-      }
+      case SRC_SENSOR:
+	channel_sensor (src->ch);
+	break;
+
+      // timeout -> default blinking
+      case SRC_IDLE:
+	channel_idle (src->ch);
+	break;
+
       // Button
-      else if (fdset[1].revents & POLLPRI) {
-	lseek(fdset[1].fd, 0, SEEK_SET);
-	if (read(fdset[1].fd, buf, MAX_BUF) < 0)
+      case SRC_BTN:
+	if (gpio_line_ack(&line_btn) < 0)
 	  perror ("read / btn");
 
 	if (t_btn)
@@ -487,49 +803,41 @@ int main(int ac, char **av)
 	    bpm_inc = -bpm_inc;
 
 	  bpm_idle += bpm_inc;
+	  beatlog_add (&beatlog, BEATLOG_BUTTON, 0, bpm_idle, gpio_timestamp());
 
-	  timeout = 30000/bpm_idle;
+	  for (j = 0 ; j < nchannels ; j++)
+	    channel_idle_arm (&channels[j]);
 	  
 	  if (verbose)
-	    printf ("new bpm= %d timeout=%d\n", bpm_idle, timeout);
+	    printf ("new bpm= %d timeout=%d\n", bpm_idle, 30000/bpm_idle);
 	}
-      }
-    }
-    // timeout -> default blinking
-    else {
-      // default blinking
-#ifdef USE_MOSQUITTO	
-        mqtt_send ("30");
-#endif
-
-	ts_i = sysTimestamp();
-
-	if (ts_s_diff < 20 || (ts_i - ts_s > 3000)) {
-	  if (verbose)
-	    printf ("Idle activated (%lld) !\n", ts_i-ts_s);
+	break;
 
-	  gpio_set_value (gpio_out, v_out);
-	  v_out = (v_out == 0 ? 1 : 0);
-	}
-	else {
-	  if (verbose)
-	    printf ("Idle ignored (%lld) !\n", ts_i-ts_s);
-	}
-	  
+      // Master mode
+      case SRC_SWITCH:
+      case SRC_SW_DEB:
+      case SRC_SCHED:
+	master_event (src->type);
+	break;
+      }
     }
 
-
     fflush(stdout);
   }
 
-  gpio_fd_close(gpio_fd);
-  if (gpio_btn)
-    gpio_fd_close (gpio_btn_fd);
-  
+  gpio_line_close(&line_btn);
+  gpio_line_close(&line_switch);
+  beatlog_close(&beatlog);
+  for (i = 0 ; i < nchannels ; i++) {
+    trace_close(&channels[i].trace);
+    gpio_line_close(&channels[i].line_in);
+    gpio_line_close(&channels[i].line_out);
 #ifdef USE_MOSQUITTO  
-  mqtt_err = mqtt_send ("30");
-  if (mqtt_err != 0) 
-    fprintf(stderr, "mqtt_send error= %d\n", mqtt_err);
+    channel_send (&channels[i], 30);
+#endif
+  }
+#ifdef USE_MOSQUITTO  
+  mqtt_flush (0);
 #endif
 
   return exit_v;
@@ -8,313 +8,172 @@
 #include <signal.h>
 #include <time.h>
 #include <pthread.h>
-#ifdef USE_MOSQUITTO
-#include <mosquitto.h>
-#endif
+
+#include "gpio.h"
+#include "beat.h"
+#include "filter.h"
+#include "telem.h"
+#include "wave.h"
+#include "mqtt.h"
+#include "rt.h"
 
 /****************************************************************
  * Constants
  ****************************************************************/
 
-#define SYSFS_GPIO_DIR "/sys/class/gpio"
-
 #define DEFAULT_BPM_IDLE   30 /* bpm = 60000 / 2 / timeout */
 #define MIN_BPM_IDLE       20
 #define MAX_BPM_IDLE       200
 #define BPM_IDLE_INC       5   /* press the button -> bpm_idle +/- 5 bpm */
 
-#define MAX_BUF 64
-
 /* global variables */
-int gpio_out = 0;
-int gpio_btn = 0;
-int count_in = 0;
-time_t t_start, t_cur, t_btn, t_btn_old;
-int bpm, bpm_idle, bpm_temp;
+int gpio_out = GPIO_NONE;
+int gpio_btn = GPIO_NONE;
+struct gpio_line line_in = GPIO_LINE_INIT;
+struct gpio_line line_out = GPIO_LINE_INIT;
+struct gpio_line line_btn = GPIO_LINE_INIT;
+time_t t_btn, t_btn_old;
+int bpm, bpm_idle;
 int verbose;
+int rt_lock = 0, rt_prio = 0, rt_cpu = -1;
 
-pthread_t sensor_thread;
-
-#ifdef USE_MOSQUITTO
-
-/************
- * MQTT
- ************/
-
-struct mosquitto *mosq = NULL;
-char *topic = NULL;
-char *mqtt_host = NULL;
-char *mqtt_topic = NULL;
-
-void mosq_log_callback(struct mosquitto *mosq, void *userdata, int level, const char *str)
-{
-  /* Pring all log messages regardless of level. */
-  
-  switch(level){
-    //case MOSQ_LOG_DEBUG:
-    //case MOSQ_LOG_INFO:
-    //case MOSQ_LOG_NOTICE:
-  case MOSQ_LOG_WARNING:
-  case MOSQ_LOG_ERR: {
-    printf("%i:%s\n", level, str);
-  }
-  }
-}
-
-void mqtt_setup()
-{
-  int port = 1883;
-  int keepalive = 60;
-  bool clean_session = true;
-
-  if (!mqtt_host || !mqtt_topic) 
-    return;
-  
-  mosquitto_lib_init();
-  mosq = mosquitto_new(NULL, clean_session, NULL);
-  if(!mosq){
-    fprintf(stderr, "Error: Out of memory.\n");
-    mqtt_host = 0;
-    return;
-    //    exit(1);
-  }
-  
-  mosquitto_log_callback_set(mosq, mosq_log_callback);
-  
-  if(mosquitto_connect(mosq, mqtt_host, port, keepalive)){
-    fprintf(stderr, "Unable to connect.\n");
-    mqtt_host = 0;
-    return;
-    //    exit(1);
-  }
-
-  int loop = mosquitto_loop_start(mosq);
-
-  if(loop != MOSQ_ERR_SUCCESS){
-    fprintf(stderr, "Unable to start loop: %i\n", loop);
-    mqtt_host = 0;
-    return;
-    //    exit(1);
-  }
-}
-
-int mqtt_send(char *msg)
-{
-  if (!mqtt_host || !mqtt_topic) 
-    return 0;
-
-  return mosquitto_publish(mosq, NULL, mqtt_topic, strlen(msg), msg, 0, 0);
-}
-
-#endif /* USE_MOSQUITTO */
-
-/****************************************************************
- * gpio_export
- ****************************************************************/
-int gpio_export(unsigned int gpio)
-{
-  int fd, len;
-  char buf[MAX_BUF];
-
-  fd = open(SYSFS_GPIO_DIR "/export", O_WRONLY);
-  if (fd < 0) {
-    perror("gpio/export");
-    return fd;
-  }
-
-  len = snprintf(buf, sizeof(buf), "%d", gpio);
-  write(fd, buf, len);
-  close(fd);
-
-  return 0;
-}
-
-/****************************************************************
- * gpio_unexport
- ****************************************************************/
-int gpio_unexport(unsigned int gpio)
-{
-  int fd, len;
-  char buf[MAX_BUF];
-
-  fd = open(SYSFS_GPIO_DIR "/unexport", O_WRONLY);
-  if (fd < 0) {
-    perror("gpio/export");
-    return fd;
-  }
-
-  len = snprintf(buf, sizeof(buf), "%d", gpio);
-  write(fd, buf, len);
-  close(fd);
-  return 0;
-}
-
-/****************************************************************
- * gpio_set_dir
- ****************************************************************/
-int gpio_set_dir(unsigned int gpio, unsigned int out_flag)
-{
-  int fd;
-  char buf[MAX_BUF];
-
-  snprintf(buf, sizeof(buf), SYSFS_GPIO_DIR  "/gpio%d/direction", gpio);
-
-  fd = open(buf, O_WRONLY);
-  if (fd < 0) {
-    perror("gpio/direction");
-    return fd;
-  }
-
-  if (out_flag)
-    write(fd, "out", 4);
-  else
-    write(fd, "in", 3);
-
-  close(fd);
-  return 0;
-}
-
-/****************************************************************
- * gpio_set_value
- ****************************************************************/
-int gpio_set_value(unsigned int gpio, unsigned int value)
-{
-  int fd;
-  char buf[MAX_BUF];
-
-  if (!gpio)
-    return 0;
-
-  snprintf(buf, sizeof(buf), SYSFS_GPIO_DIR "/gpio%d/value", gpio);
-
-  fd = open(buf, O_WRONLY);
-  if (fd < 0) {
-    perror("gpio/set-value");
-    return fd;
-  }
-
-  if (value)
-    write(fd, "1", 2);
-  else
-    write(fd, "0", 2);
-
-  close(fd);
-  return 0;
-}
-
-/****************************************************************
- * gpio_get_value
- ****************************************************************/
-int gpio_get_value(unsigned int gpio, unsigned int *value)
-{
-  int fd;
-  char buf[MAX_BUF];
-  char ch;
-
-  snprintf(buf, sizeof(buf), SYSFS_GPIO_DIR "/gpio%d/value", gpio);
-
-  fd = open(buf, O_RDONLY);
-  if (fd < 0) {
-    perror("gpio/get-value");
-    return fd;
-  }
-
-  read(fd, &ch, 1);
-
-  if (ch != '0') {
-    *value = 1;
-  } else {
-    *value = 0;
-  }
-
-  close(fd);
-  return 0;
-}
-
-
-/****************************************************************
- * gpio_set_edge
- ****************************************************************/
-
-int gpio_set_edge(unsigned int gpio, char *edge)
-{
-  int fd;
-  char buf[MAX_BUF];
-
-  snprintf(buf, sizeof(buf), SYSFS_GPIO_DIR "/gpio%d/edge", gpio);
-
-  fd = open(buf, O_WRONLY);
-  if (fd < 0) {
-    perror("gpio/set-edge");
-    return fd;
-  }
+struct telem *telem;  /* /dev/shm/pyramidion-gpioIrq_th, written by the poll loop */
 
-  write(fd, edge, strlen(edge) + 1);
-  close(fd);
-  return 0;
-}
-
-/****************************************************************
- * gpio_fd_open
- ****************************************************************/
+pthread_t sensor_thread;
+int wait_time = BEAT_MIN;
 
-int gpio_fd_open(unsigned int gpio)
-{
-  int fd;
-  char buf[MAX_BUF];
+/* sensor edges: poll loop -> filter -> output thread */
+struct beat_ring beat_ring;
+struct edge_filter filter;
+char *filter_spec = FILTER_DEFAULT;   /* -E */
+int shape = WAVE_SQUARE;              /* -s */
 
-  snprintf(buf, sizeof(buf), SYSFS_GPIO_DIR "/gpio%d/value", gpio);
+/*
+ * Output thread command word, written by the poll loop only:
+ * bit 0 = mode, bits 1.. = beat_ring index of the first edge of the
+ * sensor session (so each session is a new command value).
+ */
+#define OUT_IDLE   0  /* blink at bpm_idle */
+#define OUT_SENSOR 1  /* blink at the sensor bpm */
+#define OUT_CMD(mode, start) (((uint64_t)(start) << 1) | (mode))
 
-  fd = open(buf, O_RDONLY | O_NONBLOCK );
-  if (fd < 0) {
-    perror("gpio/fd_open");
-  }
-  return fd;
-}
+uint64_t out_cmd = OUT_CMD(OUT_IDLE, 0);
 
-/****************************************************************
- * gpio_fd_close
- ****************************************************************/
+#define BPM_WAIT_NS 50000000 /* output thread period while bpm is unknown */
 
-int gpio_fd_close(int fd)
-{
-  return close(fd);
-}
 
 void usage (void)
 {
 #ifdef USE_MOSQUITTO
-  printf("\t-i <gpio-in-pin>\n\t-o <gpio-out-pin> \n\t-g <btn-gpio>\n\t-h <mqtt_host>\n\t-T <mqtt_topic> \n\t-v verbose \n\t-b <idle-bpm>\n\t-w <time> (wait 'time' before sending bpm)\n\n");
+  printf("\t-i <gpio-in-pin>\n\t-o <gpio-out-pin> \n\t-g <btn-gpio>\n\t-h <mqtt_host>\n\t-T <mqtt_topic> \n\t-W (binary bpm messages, see wire.h)\n\t-e (binary + one message per beat)\n\t-M (led through mmap()ed registers)\n\t-F (fake registers, tests)\n\t-m (mlockall)\n\t-r <fifo-prio>\n\t-a <cpu>\n\t-v verbose \n\t-b <idle-bpm>\n\t-w <n> (beat intervals before sending bpm)\n\t-E <filter> (edge filter, default " FILTER_DEFAULT ")\n\t-s square|lubdub (led waveform)\n\n");
 #else  
-  printf("\t-i <gpio-in-pin>\n\t-o <gpio-out-pin> \n\t-g <btn-gpio>\n\t-v verbose \n\t-b <idle-bpm>\n\t-w <time> (wait 'time' before sending bpm)\n\n");
+  printf("\t-i <gpio-in-pin>\n\t-o <gpio-out-pin> \n\t-g <btn-gpio>\n\t-M (led through mmap()ed registers)\n\t-F (fake registers, tests)\n\t-m (mlockall)\n\t-r <fifo-prio>\n\t-a <cpu>\n\t-v verbose \n\t-b <idle-bpm>\n\t-w <n> (beat intervals before sending bpm)\n\t-E <filter> (edge filter, default " FILTER_DEFAULT ")\n\t-s square|lubdub (led waveform)\n\n");
 #endif
   
   exit (1);
 }
 
-// thread for blinking as receiving data from the sensor
+// One beat of a waveform table from 'start' (absolute deadlines), which
+// is moved to the end of the cycle
+static void wave_play (struct wave *w, struct timespec *start)
+{
+  struct timespec t;
+  int64_t ns;
+  int i;
+
+  for (i = 0 ; i < w->n ; i++) {
+    ns = start->tv_nsec + w->at[i];
+    t.tv_sec = start->tv_sec + ns / 1000000000;
+    t.tv_nsec = ns % 1000000000;
+    clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL);
+    gpio_line_set (&line_out, w->level[i]);
+  }
+
+  ns = start->tv_nsec + w->cycle;
+  start->tv_sec += ns / 1000000000;
+  start->tv_nsec = ns % 1000000000;
+}
+
+// Output thread, running for the process lifetime. Idle mode: blink at
+// bpm_idle. Sensor mode: edges come through beat_ring, the bpm (thus the
+// period) is updated on each edge, led is off until the bpm is known.
+// With -s lubdub each beat plays the waveform table of the current bpm
+// (built on the first beat at a new bpm, then cached).
 void *threadfunc(void *parm)
 {
-  struct timespec ts;
+  struct timespec next;
+  struct bpm_est est;
+  struct wave *w = NULL;
   unsigned int v_out = 0;
-  unsigned long period;
-  
-  int bpm = (int)parm;
-
-  if (verbose)
-    printf (">> Thread started, bpm= %d\n", bpm);
+  uint64_t cmd, cur = OUT_CMD(OUT_IDLE, 0), tail = 0;
+  int64_t ts, half;
+  int b;
 
-  // period in ns
-  period = (60000 / bpm / 2) * 1000000;
-  ts.tv_sec = period / 1000000000;
-  ts.tv_nsec = period % 1000000000;
+  bpm_est_init (&est, wait_time);
+  if (filter.flags & FILTER_RISING)
+    est.step = 1;
+  clock_gettime (CLOCK_MONOTONIC, &next);
 
   while (1) {
-    // Change gpio out state
-    gpio_set_value (gpio_out, v_out);
-    v_out = (v_out == 0 ? 1 : 0);
+    cmd = __atomic_load_n (&out_cmd, __ATOMIC_ACQUIRE);
+    if (cmd != cur) {
+      // new session: start from its first edge
+      cur = cmd;
+      tail = cmd >> 1;
+      bpm_est_init (&est, wait_time);
+      if (filter.flags & FILTER_RISING)
+	est.step = 1;
+      __atomic_store_n (&bpm, 0, __ATOMIC_RELAXED);
+      if (verbose)
+	printf (">> %s mode\n", (cmd & 1) == OUT_SENSOR ? "sensor" : "idle");
+    }
+
+    if ((cur & 1) == OUT_IDLE) {
+      half = 30000000000LL / __atomic_load_n (&bpm_idle, __ATOMIC_RELAXED);
+      if (shape == WAVE_SQUARE) {
+	gpio_line_set (&line_out, v_out);
+	v_out = (v_out == 0 ? 1 : 0);
+      }
+    }
+    else {
+      while (beat_ring_pop (&beat_ring, &tail, &ts))
+	bpm_est_add (&est, ts);
+
+      b = est.bpm;
+      __atomic_store_n (&bpm, b, __ATOMIC_RELAXED);
 
-    clock_nanosleep (CLOCK_MONOTONIC, 0, &ts, NULL);
+      if (b == 0) {
+	// led off during calculation
+	gpio_line_set (&line_out, 0);
+	half = BPM_WAIT_NS;
+      }
+      else {
+	half = 30000000000LL / b;
+	if (shape == WAVE_SQUARE) {
+	  // Change gpio out state
+	  gpio_line_set (&line_out, v_out);
+	  v_out = (v_out == 0 ? 1 : 0);
+	}
+      }
+    }
+
+    // waveform: one beat (2 x half), the table only changes with the bpm
+    if (shape != WAVE_SQUARE && half != BPM_WAIT_NS) {
+      if (!w || w->cycle != 2 * half) {
+	wave_put (w);
+	w = wave_get (shape, 2 * half);
+      }
+      if (w) {
+	wave_play (w, &next);
+	continue;
+      }
+    }
+
+    // absolute deadline: no drift when the period changes
+    next.tv_nsec += half % 1000000000;
+    next.tv_sec += half / 1000000000 + next.tv_nsec / 1000000000;
+    next.tv_nsec %= 1000000000;
+    clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
   }
 }
 
@@ -322,7 +181,7 @@ void *threadfunc(void *parm)
 static void got_exit (int sig)
 {
   /* Clear gpio out before exiting */
-  gpio_set_value (gpio_out, 0);
+  gpio_line_set (&line_out, 0);
 
   printf ("Got signal, exiting !\n");
   exit (0);
@@ -336,16 +195,20 @@ int main(int ac, char **av)
 {
   struct pollfd fdset[2];
   int nfds = 2;
-  int gpio_fd, gpio_btn_fd, timeout, rc;
-  char buf[MAX_BUF], *cp;
-  unsigned int gpio = 0;
-  unsigned int v_out = 0;
-  int wait_time = 10, exit_v = 0;
+  int timeout, rc;
+  char *cp;
+  int gpio = GPIO_NONE;
+  int exit_v = 0;
+  int sensor_mode = 0, bpm_sent = 0, b, i, n, r;
+  struct gpio_edge edges[GPIO_EVENT_MAX];
   int skip_btn_event = 1;
   int bpm_inc = BPM_IDLE_INC;
 #ifdef USE_MOSQUITTO  
   int mqtt_err;
-  char mqtt_msg[MAX_BUF];
+  int64_t beat_ts = 0;     /* last beat, MQTT binary (-W) */
+  int64_t last_beat = 0;   /* previous sensor beat (-e), 0 -> none */
+  struct { int bpm; int64_t ts, ibi; } beats[GPIO_EVENT_MAX];   /* -e, sent after telem_end() */
+  int nbeats;
 #endif  
 
   
@@ -377,6 +240,14 @@ int main(int ac, char **av)
       case 'T' :
 	mqtt_topic = *++av;
 	break;
+
+      case 'W' :
+	mqtt_wire = MQTT_WIRE_BINARY;
+	break;
+
+      case 'e' :
+	mqtt_wire = MQTT_WIRE_BEATS;
+	break;
 #endif	
 
       case 'b' :
@@ -387,6 +258,29 @@ int main(int ac, char **av)
 	wait_time = atoi(*++av);
 	break;
 
+      case 'M' :
+	gpio_mmio = GPIO_MMIO_HW; break;
+
+      case 'F' :
+	gpio_mmio = GPIO_MMIO_FAKE; break;
+
+      case 's' :
+	if ((shape = wave_shape (*++av)) < 0)
+	  usage ();
+	break;
+
+      case 'E' :
+	filter_spec = *++av; break;
+
+      case 'm' :
+	rt_lock = 1; break;
+
+      case 'r' :
+	rt_prio = atoi(*++av); break;
+
+      case 'a' :
+	rt_cpu = atoi(*++av); break;
+
       case 'v' :
 	verbose = 1; break;
 
@@ -398,54 +292,61 @@ int main(int ac, char **av)
       break;
   }
 
-  if (!gpio || !gpio_out)
+  if (gpio < 0 || gpio_out < 0)
+    usage();
+
+  if (edge_filter_init (&filter, filter_spec) < 0)
     usage();
 
   timeout = 30000 / bpm_idle;
   
   // GPIO in
-  gpio_export(gpio);
-  gpio_set_dir(gpio, 0);
-  gpio_set_edge(gpio, "both");
-  gpio_fd = gpio_fd_open(gpio);
+  gpio_line_open(&line_in, gpio, 0, "both");
 
   // GPIO out
-  if (gpio_out) {
-    gpio_export(gpio_out);
-    gpio_set_dir(gpio_out, 1);
-  }
+  gpio_line_open(&line_out, gpio_out, 1, NULL);
+
+  telem = telem_open ("gpioIrq_th", 1);
+  telem->ch[0].gpio_in = line_in.gpio;
+  telem->ch[0].gpio_out = gpio_out;
 
   // GPIO button (in)
-  if (gpio_btn) {
-    gpio_export(gpio_btn);
-    gpio_set_dir(gpio_btn, 0);
-    gpio_set_edge(gpio_btn, "falling");
-    gpio_btn_fd = gpio_fd_open(gpio_btn);
-  }
+  gpio_line_open(&line_btn, gpio_btn, 0, "falling");
 
   signal (SIGINT, got_exit);
   signal (SIGTERM, got_exit);
 
 #ifdef USE_MOSQUITTO
   mqtt_setup();
-  sprintf (buf, "%d", bpm_idle);
-  mqtt_err = mqtt_send (buf);
-  if (mqtt_err != 0) 
+  mqtt_err = mqtt_send_bpm (mqtt_topic, 0, bpm_idle, 0);
+  if (mqtt_err != 0) {
     fprintf(stderr, "mqtt_send error= %d\n", mqtt_err);
+    telem->mqtt_errors++;
+  }
 #endif
 
+  // RT setup after the MQTT thread is started (it stays SCHED_OTHER),
+  // the poll loop and the output thread get SCHED_FIFO + CPU pinning
+  rt_setup (rt_lock, rt_prio, rt_cpu);
+
+  // output thread (inherits the RT setup), idle mode first
+  if (pthread_create(&sensor_thread, NULL, threadfunc, NULL) != 0) {
+    perror ("pthread_create");
+    exit (1);
+  }
+
   if (verbose)
     printf ("default blinking= %d bpm\n", bpm_idle);
   
   while (1) {
     memset((void*)fdset, 0, sizeof(fdset));
 
-    fdset[0].fd = gpio_fd;
-    fdset[0].events = POLLPRI;
+    fdset[0].fd = line_in.fd;
+    fdset[0].events = line_in.events;
 
-    if (gpio_btn) {
-      fdset[1].fd = gpio_btn_fd;
-      fdset[1].events = POLLPRI;
+    if (gpio_btn >= 0) {
+      fdset[1].fd = line_btn.fd;
+      fdset[1].events = line_btn.events;
     }
 
     rc = poll(fdset, nfds, timeout);
@@ -462,87 +363,114 @@ int main(int ac, char **av)
 #endif      
     }
 
-    // timeout -> default blinking
+    // timeout -> default blinking (done by the output thread)
     if (rc == 0) {
-      int r;
-
-      // default blinking
-      if (bpm) {
-	void *status;
+      if (sensor_mode) {
 #ifdef USE_MOSQUITTO	
-        mqtt_send ("30");
+	if (bpm_sent)
+	  mqtt_send_bpm (mqtt_topic, 0, 30, 0);
+	last_beat = 0;
 #endif
-	//  Stop current thread
-	if (verbose)
-	  printf (">> Cancelling thread\n");
-	r = pthread_cancel(sensor_thread);
-	if (verbose)
-	  printf (">> pthread_cancel = %d\n", r);
-	pthread_join(sensor_thread, &status);
-	if (verbose)
-	  printf (">> Thread cancelled !!\n");
+	sensor_mode = 0;
+	bpm_sent = 0;
+	__atomic_store_n (&bpm, 0, __ATOMIC_RELEASE);
+	edge_filter_bpm (&filter, 0);
+	__atomic_store_n (&out_cmd, OUT_CMD(OUT_IDLE, 0), __ATOMIC_RELEASE);
       }
 
-      // Reset bpm to 0
-      bpm = bpm_temp = 0;
-      count_in = 0;
-      t_start = t_cur = 0;
+      telem_begin (telem);
+      telem->ch[0].timeouts++;
+      telem->ch[0].bpm = 0;
+      telem_end (telem);
 
       if (verbose)
 	printf(".");
-
-      gpio_set_value (gpio_out, v_out);
-      v_out = (v_out == 0 ? 1 : 0);
     }
     // rc > 0 => something happened on fds
     else {
-      if (fdset[0].revents & POLLPRI) {
-	lseek(fdset[0].fd, 0, SEEK_SET);
-	if (read(fdset[0].fd, buf, MAX_BUF) < 0)
+      if (fdset[0].revents & line_in.events) {
+	n = gpio_line_read_edges(&line_in, edges, GPIO_EVENT_MAX);
+	if (n < 0)
 	  perror ("read / GPIO-in");
 
-	// Start counting time and events
-	if (t_start == 0)
-	  t_start = time(0);
-	t_cur = time(0);
-      	count_in++;
-      
-	// bpm == 0 -> We need to get it !
-	if (bpm == 0) {
-	  // led off during calculation
-	  gpio_set_value (gpio_out, 0);
-	  // Wait some seconds (default is 10) before sending bpm because of sensor quality, then create the thread
-	  if (t_cur - t_start >= wait_time) {
-	    bpm = bpm_temp;
-	    if (verbose)
-	      printf (">>> final bpm = %d\n", bpm);
+	// first edge -> sensor mode, session starts at this edge
+	if (!sensor_mode && n > 0) {
+	  sensor_mode = 1;
+	  __atomic_store_n (&out_cmd, OUT_CMD(OUT_SENSOR, beat_ring.head), __ATOMIC_RELEASE);
+	}
+
+#ifdef USE_MOSQUITTO
+	nbeats = 0;
+#endif
+	telem_begin (telem);
+	for (i = 0 ; i < n ; i++) {
+	  r = edge_filter_add (&filter, &edges[i]);
+	  if (r == FILTER_DROP)
+	    telem->ch[0].dropped++;
+
+	  // rhythm changed: new session, the thread restarts its estimator
+	  if (r & FILTER_RESET) {
+	    __atomic_store_n (&out_cmd, OUT_CMD(OUT_SENSOR, beat_ring.head), __ATOMIC_RELEASE);
+#ifdef USE_MOSQUITTO
+	    last_beat = 0;
+#endif
+	  }
+
+	  if (r & FILTER_BEAT) {
+	    beat_ring_push (&beat_ring, (r & FILTER_GAP) ? -edges[i].ts : edges[i].ts);
 #ifdef USE_MOSQUITTO	  
-	    sprintf (mqtt_msg, "%d", bpm);
-	    mqtt_err = mqtt_send(mqtt_msg);
-	    if (mqtt_err != 0) 
-	      fprintf(stderr, "mqtt_send error= %d\n", mqtt_err);
+	    // the beat itself is the rising edge (the ring takes both)
+	    if (!edges[i].value)
+	      continue;
+
+	    beat_ts = edges[i].ts;
+	    beats[nbeats].bpm = __atomic_load_n (&bpm, __ATOMIC_RELAXED);
+	    beats[nbeats].ts = edges[i].ts;
+	    beats[nbeats].ibi = (last_beat && !(r & FILTER_GAP)) ? edges[i].ts - last_beat : 0;
+	    nbeats++;
+	    last_beat = edges[i].ts;
 #endif
-	    // Create sensor thread with bpm value
-	    if (pthread_create(&sensor_thread, NULL, threadfunc, (void *)bpm) < 0)
-	      perror ("pthread_create");
 	  }
-	  else {
-	    // get the bpm for the current interval
-	    bpm_temp = (int)(30 * (double)count_in / (double)(t_cur - t_start));
-	    if (verbose && (t_cur > t_start))
-	      printf (">>> current bpm after %d seconds and %d event(s) = %d\n", (int)(t_cur-t_start), count_in, bpm_temp);
+	}
+
+	b = __atomic_load_n (&bpm, __ATOMIC_RELAXED);
+	edge_filter_bpm (&filter, b);
+	telem->ch[0].edges += n > 0 ? n : 0;
+	telem->ch[0].bpm = b;
+	telem_end (telem);
+
+	// MQTT queue lock + prints: outside of the telem write section
+#ifdef USE_MOSQUITTO
+	// -e: the beats as they happen, no wait for the -w window
+	for (i = 0 ; i < nbeats ; i++) {
+	  mqtt_err = mqtt_send_beat (mqtt_topic, 0, beats[i].bpm, beats[i].ts, beats[i].ibi);
+	  if (mqtt_err != 0) {
+	    fprintf(stderr, "mqtt_send error= %d\n", mqtt_err);
+	    telem_begin (telem);
+	    telem->mqtt_errors++;
+	    telem_end (telem);
 	  }
 	}
-	// we have bpm already
-	else {
-	  bpm_temp = 0;
-	  //        if (verbose)
-	  //	  printf (">>> thread is running, current bpm = %d\n", bpm);
+#endif
+
+	// bpm known or changed -> send it
+	if (b && b != bpm_sent) {
+	  if (verbose)
+	    printf (">>> current bpm = %d\n", b);
+#ifdef USE_MOSQUITTO	  
+	  mqtt_err = mqtt_send_bpm (mqtt_topic, 0, b, beat_ts);
+	  if (mqtt_err != 0) {
+	    fprintf(stderr, "mqtt_send error= %d\n", mqtt_err);
+	    telem_begin (telem);
+	    telem->mqtt_errors++;
+	    telem_end (telem);
+	  }
+#endif
+	  bpm_sent = b;
 	}
       }
-      else if (fdset[1].revents & POLLPRI) {
-	lseek(fdset[1].fd, 0, SEEK_SET);
-	if (read(fdset[1].fd, buf, MAX_BUF) < 0)
+      else if (fdset[1].revents & line_btn.events) {
+	if (gpio_line_ack(&line_btn) < 0)
 	  perror ("read / btn");
 
 	if (t_btn)
@@ -554,10 +482,10 @@ int main(int ac, char **av)
 	  skip_btn_event = 0;
 	}
 	else {
-	  if (bpm == MIN_BPM_IDLE || bpm_idle == MAX_BPM_IDLE)
+	  if (bpm_idle == MIN_BPM_IDLE || bpm_idle == MAX_BPM_IDLE)
 	    bpm_inc = -bpm_inc;
 
-	  bpm_idle += bpm_inc;
+	  __atomic_store_n (&bpm_idle, bpm_idle + bpm_inc, __ATOMIC_RELAXED);
 
 	  timeout = 30000/bpm_idle;
 	  
@@ -570,14 +498,15 @@ int main(int ac, char **av)
     fflush(stdout);
   }
 
-  gpio_fd_close(gpio_fd);
-  if (gpio_btn)
-    gpio_fd_close (gpio_btn_fd);
+  gpio_line_close(&line_in);
+  gpio_line_close(&line_btn);
+  gpio_line_close(&line_out);
   
 #ifdef USE_MOSQUITTO  
-  mqtt_err = mqtt_send ("30");
+  mqtt_err = mqtt_send_bpm (mqtt_topic, 0, 30, 0);
   if (mqtt_err != 0) 
     fprintf(stderr, "mqtt_send error= %d\n", mqtt_err);
+  mqtt_flush (0);
 #endif
 
   return exit_v;
@@ -0,0 +1,54 @@
+#!/bin/sh
+#set -x
+#
+# Simulated GPIO chip (gpio-sim module) to run gpioIrq -c on a PC
+#
+# gpio_sim.sh setup           -> create the chip, print its name
+# gpio_sim.sh pulse <n> <bpm> -> toggle input line <n> at <bpm>
+# gpio_sim.sh cleanup
+#
+# Example:
+#   CHIP=$(gpio_sim.sh setup)
+#   gpio_sim.sh pulse 0 72 &
+#   gpioIrq -c $CHIP -i 0 -o 1 -g 2 -d 2000 -v
+
+CFS=/sys/kernel/config/gpio-sim/pyramidion
+NLINES=4
+
+sim_dir ()
+{
+    echo /sys/devices/platform/$(cat $CFS/dev_name)/$(cat $CFS/gpio-bank0/chip_name)
+}
+
+case "$1" in
+    setup)
+	modprobe gpio-sim || exit 1
+	mkdir -p $CFS/gpio-bank0
+	echo $NLINES > $CFS/gpio-bank0/num_lines
+	echo 1 > $CFS/live
+	cat $CFS/gpio-bank0/chip_name
+	;;
+
+    pulse)
+	# half period in ms (same as 60000/bpm/2 in pyramidion-receive.sh)
+	HP=$(expr 60000 / $3 / 2)
+	PULL=$(sim_dir)/sim_gpio${2}/pull
+	while [ 1 ]
+	do
+	    echo pull-up > $PULL
+	    sleep $(echo "$HP / 1000" | bc -l)
+	    echo pull-down > $PULL
+	    sleep $(echo "$HP / 1000" | bc -l)
+	done
+	;;
+
+    cleanup)
+	echo 0 > $CFS/live
+	rmdir $CFS/gpio-bank0 $CFS
+	;;
+
+    *)
+	echo "Usage: $0 setup | pulse <line> <bpm> | cleanup"
+	exit 1
+	;;
+esac
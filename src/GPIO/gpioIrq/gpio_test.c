@@ -9,196 +9,25 @@
 #include <time.h>
 #include <pthread.h>
 
+#include "gpio.h"
+#include "mqtt.h"
+
 /****************************************************************
  * Constants
  ****************************************************************/
 
-#define SYSFS_GPIO_DIR "/sys/class/gpio"
-#define MAX_BUF 64
 #define POLL_TIMEOUT (1000) /* 30 bpm = 60000/2/timeout */
 
 
 /* global variables */
-int gpio_out = 0;
-int gpio_btn = 0;
+int gpio_out = GPIO_NONE;
+int gpio_btn = GPIO_NONE;
+struct gpio_line line_in = GPIO_LINE_INIT;
+struct gpio_line line_out = GPIO_LINE_INIT;
+struct gpio_line line_btn = GPIO_LINE_INIT;
 int count_in = 0;
 int verbose;
 
-// GPIO
-
-/****************************************************************
- * gpio_export
- ****************************************************************/
-int gpio_export(unsigned int gpio)
-{
-  int fd, len;
-  char buf[MAX_BUF];
-
-  fd = open(SYSFS_GPIO_DIR "/export", O_WRONLY);
-  if (fd < 0) {
-    perror("gpio/export");
-    return fd;
-  }
-
-  len = snprintf(buf, sizeof(buf), "%d", gpio);
-  write(fd, buf, len);
-  close(fd);
-
-  return 0;
-}
-
-/****************************************************************
- * gpio_unexport
- ****************************************************************/
-int gpio_unexport(unsigned int gpio)
-{
-  int fd, len;
-  char buf[MAX_BUF];
-
-  fd = open(SYSFS_GPIO_DIR "/unexport", O_WRONLY);
-  if (fd < 0) {
-    perror("gpio/export");
-    return fd;
-  }
-
-  len = snprintf(buf, sizeof(buf), "%d", gpio);
-  write(fd, buf, len);
-  close(fd);
-  return 0;
-}
-
-/****************************************************************
- * gpio_set_dir
- ****************************************************************/
-int gpio_set_dir(unsigned int gpio, unsigned int out_flag)
-{
-  int fd, len;
-  char buf[MAX_BUF];
-
-  len = snprintf(buf, sizeof(buf), SYSFS_GPIO_DIR  "/gpio%d/direction", gpio);
-
-  fd = open(buf, O_WRONLY);
-  if (fd < 0) {
-    perror("gpio/direction");
-    return fd;
-  }
-
-  if (out_flag)
-    write(fd, "out", 4);
-  else
-    write(fd, "in", 3);
-
-  close(fd);
-  return 0;
-}
-
-/****************************************************************
- * gpio_set_value
- ****************************************************************/
-int gpio_set_value(unsigned int gpio, unsigned int value)
-{
-  int fd, len;
-  char buf[MAX_BUF];
-
-  if (!gpio)
-    return 0;
-
-  len = snprintf(buf, sizeof(buf), SYSFS_GPIO_DIR "/gpio%d/value", gpio);
-
-  fd = open(buf, O_WRONLY);
-  if (fd < 0) {
-    perror("gpio/set-value");
-    return fd;
-  }
-
-  if (value)
-    write(fd, "1", 2);
-  else
-    write(fd, "0", 2);
-
-  close(fd);
-  return 0;
-}
-
-/****************************************************************
- * gpio_get_value
- ****************************************************************/
-int gpio_get_value(unsigned int gpio, unsigned int *value)
-{
-  int fd, len;
-  char buf[MAX_BUF];
-  char ch;
-
-  len = snprintf(buf, sizeof(buf), SYSFS_GPIO_DIR "/gpio%d/value", gpio);
-
-  fd = open(buf, O_RDONLY);
-  if (fd < 0) {
-    perror("gpio/get-value");
-    return fd;
-  }
-
-  read(fd, &ch, 1);
-
-  if (ch != '0') {
-    *value = 1;
-  } else {
-    *value = 0;
-  }
-
-  close(fd);
-  return 0;
-}
-
-
-/****************************************************************
- * gpio_set_edge
- ****************************************************************/
-
-int gpio_set_edge(unsigned int gpio, char *edge)
-{
-  int fd, len;
-  char buf[MAX_BUF];
-
-  len = snprintf(buf, sizeof(buf), SYSFS_GPIO_DIR "/gpio%d/edge", gpio);
-
-  fd = open(buf, O_WRONLY);
-  if (fd < 0) {
-    perror("gpio/set-edge");
-    return fd;
-  }
-
-  write(fd, edge, strlen(edge) + 1);
-  close(fd);
-  return 0;
-}
-
-/****************************************************************
- * gpio_fd_open
- ****************************************************************/
-
-int gpio_fd_open(unsigned int gpio)
-{
-  int fd, len;
-  char buf[MAX_BUF];
-
-  len = snprintf(buf, sizeof(buf), SYSFS_GPIO_DIR "/gpio%d/value", gpio);
-
-  fd = open(buf, O_RDONLY | O_NONBLOCK );
-  if (fd < 0) {
-    perror("gpio/fd_open");
-  }
-  return fd;
-}
-
-/****************************************************************
- * gpio_fd_close
- ****************************************************************/
-
-int gpio_fd_close(int fd)
-{
-  return close(fd);
-}
-
 void usage (void)
 {
 #ifdef USE_MOSQUITTO
@@ -214,7 +43,7 @@ void usage (void)
 static void got_exit (int sig)
 {
   /* Clear gpio out before exiting */
-  gpio_set_value (gpio_out, 0);
+  gpio_line_set (&line_out, 0);
 
   printf ("Got signal, exiting !\n");
   exit (0);
@@ -228,9 +57,9 @@ int main(int ac, char **av)
 {
   struct pollfd fdset[2];
   int nfds = 2;
-  int gpio_fd, gpio_btn_fd, timeout, rc;
-  char buf[MAX_BUF], *cp, mqtt_msg[MAX_BUF];
-  unsigned int gpio = 0;
+  int timeout, rc;
+  char *cp, mqtt_msg[MAX_BUF];
+  int gpio = GPIO_NONE;
   int len;
   int val;
   unsigned int v_out = 0;
@@ -281,27 +110,19 @@ int main(int ac, char **av)
       break;
   }
 
-  if (!gpio || !gpio_out)
+  if (gpio < 0 || gpio_out < 0)
     usage();
 
   // GPIO in
-  gpio_export(gpio);
-  gpio_set_dir(gpio, 0);
-  gpio_set_edge(gpio, "both");
-  gpio_fd = gpio_fd_open(gpio);
+  gpio_line_open(&line_in, gpio, 0, "both");
 
   // GPIO out
-  if (gpio_out) {
-    gpio_export(gpio_out);
-    gpio_set_dir(gpio_out, 1);
-  }
+  gpio_line_open(&line_out, gpio_out, 1, NULL);
 
   // GPIO button (in)
-  if (gpio_btn) {
-    gpio_export(gpio_btn);
-    gpio_set_dir(gpio_btn, 0);
-    gpio_btn_fd = gpio_fd_open(gpio_btn);
-    printf ("fd= %d\n", gpio_btn_fd);
+  if (gpio_btn >= 0) {
+    gpio_line_open(&line_btn, gpio_btn, 0, NULL);
+    printf ("fd= %d\n", line_btn.fd);
   }
 
   signal (SIGINT, got_exit);
@@ -312,11 +133,11 @@ int main(int ac, char **av)
   while (1) {
     memset((void*)fdset, 0, sizeof(fdset));
 
-    fdset[0].fd = gpio_fd;
+    fdset[0].fd = line_in.fd;
     fdset[0].events = POLLPRI;
 
-    if (gpio_btn) {
-      fdset[1].fd = gpio_btn_fd;
+    if (gpio_btn >= 0) {
+      fdset[1].fd = line_btn.fd;
       fdset[1].events = POLLPRI;
     }
 
@@ -333,20 +154,18 @@ int main(int ac, char **av)
       if (verbose)
 	printf(".");
 
-      gpio_set_value (gpio_out, v_out);
+      gpio_line_set (&line_out, v_out);
       v_out = (v_out == 0 ? 1 : 0);
     }
     // rc > 0 => something happened on fds
     else {
       if (fdset[0].revents & POLLPRI) {
-	lseek(fdset[0].fd, 0, SEEK_SET);
-	len = read(fdset[0].fd, buf, MAX_BUF);
+	len = gpio_line_ack(&line_in);
 
 	printf ("len= %d on fdset 0\n", len);
       }
       else if (fdset[1].revents & POLLPRI) {
-	lseek(fdset[1].fd, 0, SEEK_SET);
-	len = read(fdset[1].fd, buf, MAX_BUF);
+	len = gpio_line_ack(&line_btn);
 	printf ("len= %d on fdset 1\n", len);
       }
     }
@@ -355,9 +174,9 @@ int main(int ac, char **av)
   }
 
  the_end:
-  gpio_fd_close(gpio_fd);
-  if (gpio_btn)
-    gpio_fd_close(gpio_btn_fd);
+  gpio_line_close(&line_in);
+  gpio_line_close(&line_btn);
+  gpio_line_close(&line_out);
   
   return exit_v;
 }
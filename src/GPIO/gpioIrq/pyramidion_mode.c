@@ -0,0 +1,271 @@
+//
+// pyramidion_mode: auto/manual/schedule controller (replaces the
+// 2 s polling loop of pyramidion-button.sh + the cron.tab entries)
+//
+// The sensor pipeline runs when the manual switch is on (level 0,
+// as in the script) or inside the daily schedule (-S, 19:00-01:00 by
+// default). Everything is event driven: switch edges (sysfs or chardev
+// with -c), a debounce timer, a CLOCK_REALTIME timer on the next
+// schedule boundary (re-armed if the clock is set, e.g. NTP at boot)
+// and signals. The pipeline is a systemd service (-s, systemctl is only
+// run on a transition) or a command run as our child (-x).
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <sys/wait.h>
+
+#include "gpio.h"
+#include "sched.h"
+
+/****************************************************************
+ * Constants
+ ****************************************************************/
+
+#define DEFAULT_SERVICE  "pyramidion-gpio.service"
+#define DEBOUNCE_MS      50
+#define RESTART_MIN      5    /* sec, -x command dying faster is not restarted */
+
+#define FD_BTN      0
+#define FD_DEBOUNCE 1
+#define FD_SCHED    2
+#define FD_SIG      3
+
+/* global variables */
+struct gpio_line line_btn = GPIO_LINE_INIT;
+char *service = DEFAULT_SERVICE;   /* -s */
+char *command = NULL;              /* -x */
+struct sched sched;                /* -S */
+int switch_on, sched_on, running;
+pid_t child;
+time_t child_start;
+int verbose;
+
+void usage (void)
+{
+  printf("\t-g <btn-gpio>\n\t-c <gpiochip> (use chardev, pin is a line offset)\n\t-d <debounce-us> (chardev)\n\t-S <HH:MM-HH:MM|none> (schedule, default " SCHED_DEFAULT ")\n\t-s <service> (default " DEFAULT_SERVICE ")\n\t-x <command> (run it instead of the service)\n\t-v verbose\n\n");
+  exit (1);
+}
+
+/****************************************************************
+ * Pipeline start/stop
+ ****************************************************************/
+
+int systemctl (char *verb)
+{
+  char cmd[256];
+
+  snprintf (cmd, sizeof(cmd), "systemctl %s %s", verb, service);
+
+  return system (cmd);
+}
+
+void pipeline (int on)
+{
+  if (on == running)
+    return;
+
+  if (verbose)
+    printf ("%s pipeline (%s)\n", on ? "Starting" : "Stopping", switch_on ? "manual" : sched_on ? "auto" : "off");
+
+  if (!command) {
+    systemctl (on ? "start" : "stop");
+  }
+  else if (on) {
+    if ((child = fork ()) == 0) {
+      sigset_t none;
+
+      // our signals are blocked (signalfd), not the command's
+      sigemptyset (&none);
+      sigprocmask (SIG_SETMASK, &none, NULL);
+      execl ("/bin/sh", "sh", "-c", command, NULL);
+      _exit (127);
+    }
+    if (child < 0) {
+      perror ("fork");
+      child = 0;
+      return;
+    }
+    child_start = time (0);
+  }
+  else if (child) {
+    kill (child, SIGTERM);
+    waitpid (child, NULL, 0);
+    child = 0;
+  }
+
+  running = on;
+}
+
+void update (void)
+{
+  pipeline (switch_on || sched_on);
+}
+
+/****************************************************************
+ * Main
+ ****************************************************************/
+
+int main(int ac, char **av)
+{
+  struct pollfd fdset[4];
+  struct itimerspec its;
+  struct signalfd_siginfo si;
+  sigset_t mask;
+  uint64_t ticks;
+  int gpio = GPIO_NONE;
+  unsigned int v;
+  char *cp;
+  int stop = 0;
+
+  sched_parse (&sched, SCHED_DEFAULT);
+
+  while (--ac) {
+    if ((cp = *++av) == NULL)
+      break;
+    if (*cp == '-' && *++cp) {
+      switch(*cp) {
+      case 'g' :
+	gpio = atoi(*++av);
+	break;
+
+      case 'c' :
+	gpio_chip = *++av;
+	break;
+
+      case 'd' :
+	gpio_debounce_us = atoi(*++av);
+	break;
+
+      case 'S' :
+	if (sched_parse (&sched, *++av) < 0)
+	  usage();
+	break;
+
+      case 's' :
+	service = *++av;
+	break;
+
+      case 'x' :
+	command = *++av;
+	break;
+
+      case 'v' :
+	verbose = 1; break;
+
+      default:
+	usage();
+      }
+    }
+    else
+      break;
+  }
+
+  if (gpio < 0 && sched.start < 0)
+    usage();
+
+  // signals as events: SIGCHLD (-x command died), SIGINT/SIGTERM
+  sigemptyset (&mask);
+  sigaddset (&mask, SIGCHLD);
+  sigaddset (&mask, SIGINT);
+  sigaddset (&mask, SIGTERM);
+  sigprocmask (SIG_BLOCK, &mask, NULL);
+
+  memset (fdset, 0, sizeof(fdset));
+  fdset[FD_SIG].fd = signalfd (-1, &mask, SFD_CLOEXEC);
+  fdset[FD_DEBOUNCE].fd = timerfd_create (CLOCK_MONOTONIC, TFD_CLOEXEC);
+  fdset[FD_SCHED].fd = timerfd_create (CLOCK_REALTIME, TFD_CLOEXEC);
+  if (fdset[FD_SIG].fd < 0 || fdset[FD_DEBOUNCE].fd < 0 || fdset[FD_SCHED].fd < 0) {
+    perror ("signalfd / timerfd_create");
+    exit (1);
+  }
+  fdset[FD_SIG].events = fdset[FD_DEBOUNCE].events = fdset[FD_SCHED].events = POLLIN;
+
+  // switch (in), both edges
+  gpio_line_open (&line_btn, gpio, 0, "both");
+  fdset[FD_BTN].fd = line_btn.fd;
+  fdset[FD_BTN].events = line_btn.events;
+
+  if (gpio_line_get (&line_btn, &v) == 0)
+    switch_on = (v == 0);
+  sched_on = sched_active (&sched, time (0));
+  sched_arm (&sched, fdset[FD_SCHED].fd);
+
+  // the service may already run (cron, restart of this daemon...)
+  if (!command)
+    running = (systemctl ("is-active --quiet") == 0);
+
+  update ();
+
+  while (!stop) {
+    if (poll (fdset, 4, -1) < 0) {
+      if (errno == EINTR)
+	continue;
+      perror ("poll");
+      break;
+    }
+
+    // switch edge: wait for it to settle, then read the level
+    if (fdset[FD_BTN].revents & line_btn.events) {
+      gpio_line_ack (&line_btn);
+
+      memset (&its, 0, sizeof(its));
+      its.it_value.tv_nsec = DEBOUNCE_MS * 1000000;
+      timerfd_settime (fdset[FD_DEBOUNCE].fd, 0, &its, NULL);
+    }
+
+    if (fdset[FD_DEBOUNCE].revents & POLLIN) {
+      if (read (fdset[FD_DEBOUNCE].fd, &ticks, sizeof(ticks)) > 0 && gpio_line_get (&line_btn, &v) == 0) {
+	if (verbose && switch_on != (v == 0))
+	  printf ("Switch %s\n", v ? "off" : "on");
+	switch_on = (v == 0);
+	update ();
+      }
+    }
+
+    // schedule boundary, or clock set (read() -> ECANCELED): re-evaluate
+    if (fdset[FD_SCHED].revents & POLLIN) {
+      read (fdset[FD_SCHED].fd, &ticks, sizeof(ticks));
+      sched_on = sched_active (&sched, time (0));
+      sched_arm (&sched, fdset[FD_SCHED].fd);
+      update ();
+    }
+
+    if (fdset[FD_SIG].revents & POLLIN) {
+      if (read (fdset[FD_SIG].fd, &si, sizeof(si)) != sizeof(si))
+	continue;
+
+      if (si.ssi_signo == SIGCHLD) {
+	// -x command exited by itself: start it again if still wanted
+	if (child && waitpid (child, NULL, WNOHANG) == child) {
+	  child = 0;
+	  running = 0;
+	  if (time (0) - child_start < RESTART_MIN) {
+	    fprintf (stderr, "%s: exited at once, not restarted\n", command);
+	    continue;
+	  }
+	  update ();
+	}
+      }
+      else
+	stop = 1;
+    }
+
+    fflush (stdout);
+  }
+
+  // a command we started dies with us, a service is left as it is
+  if (command)
+    pipeline (0);
+
+  gpio_line_close (&line_btn);
+
+  return 0;
+}
@@ -0,0 +1,102 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/timerfd.h>
+
+#include "sched.h"
+
+/****************************************************************
+ * sched_parse ("HH:MM-HH:MM" or "none")
+ ****************************************************************/
+
+int sched_parse(struct sched *s, char *spec)
+{
+  int h1, m1, h2, m2;
+
+  if (!strcmp(spec, "none")) {
+    s->start = -1;
+    return 0;
+  }
+
+  if (sscanf(spec, "%d:%d-%d:%d", &h1, &m1, &h2, &m2) != 4 ||
+      h1 < 0 || h1 > 23 || h2 < 0 || h2 > 23 || m1 < 0 || m1 > 59 || m2 < 0 || m2 > 59)
+    return -1;
+
+  s->start = h1 * 60 + m1;
+  s->stop = h2 * 60 + m2;
+
+  return 0;
+}
+
+/****************************************************************
+ * sched_active (inside [start, stop[)
+ ****************************************************************/
+
+int sched_active(struct sched *s, time_t now)
+{
+  struct tm tm;
+  int m;
+
+  if (s->start < 0)
+    return 0;
+
+  localtime_r(&now, &tm);
+  m = tm.tm_hour * 60 + tm.tm_min;
+
+  if (s->start <= s->stop)
+    return m >= s->start && m < s->stop;
+
+  return m >= s->start || m < s->stop;
+}
+
+/****************************************************************
+ * sched_next (next start or stop time, mktime() handles DST)
+ ****************************************************************/
+
+time_t sched_next(struct sched *s, time_t now)
+{
+  struct tm tm;
+  time_t t, next = 0;
+  int day, k, m;
+
+  for (day = 0 ; day < 2 ; day++) {
+    for (k = 0 ; k < 2 ; k++) {
+      m = k ? s->stop : s->start;
+
+      localtime_r(&now, &tm);
+      tm.tm_mday += day;
+      tm.tm_hour = m / 60;
+      tm.tm_min = m % 60;
+      tm.tm_sec = 0;
+      tm.tm_isdst = -1;
+      t = mktime(&tm);
+
+      if (t > now && (!next || t < next))
+	next = t;
+    }
+  }
+
+  return next;
+}
+
+/****************************************************************
+ * sched_arm
+ ****************************************************************/
+
+int sched_arm(struct sched *s, int fd)
+{
+  struct itimerspec its;
+
+  if (s->start < 0)
+    return 0;
+
+  memset(&its, 0, sizeof(its));
+  its.it_value.tv_sec = sched_next(s, time(0));
+
+  if (timerfd_settime(fd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET, &its, NULL) < 0) {
+    perror("timerfd_settime / schedule");
+    return -1;
+  }
+
+  return 0;
+}
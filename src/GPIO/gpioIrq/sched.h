@@ -0,0 +1,25 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <time.h>
+
+/****************************************************************
+ * Daily schedule window ("HH:MM-HH:MM", may cross midnight), used
+ * instead of the cron.tab start/stop entries
+ ****************************************************************/
+
+#define SCHED_DEFAULT "19:00-01:00"
+
+struct sched {
+  int start, stop;   /* minutes in the day, start < 0 -> no schedule */
+};
+
+int sched_parse(struct sched *s, char *spec);
+int sched_active(struct sched *s, time_t now);
+time_t sched_next(struct sched *s, time_t now);
+
+/* arm a CLOCK_REALTIME timerfd on the next boundary (cancelled if the
+   clock is set, read() then fails with ECANCELED: re-arm) */
+int sched_arm(struct sched *s, int fd);
+
+#endif /* SCHED_H */
@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "trace.h"
+
+/****************************************************************
+ * trace_open_write
+ ****************************************************************/
+
+int trace_open_write(struct trace *t, char *file)
+{
+  memset(t, 0, sizeof(*t));
+
+  if ((t->f = fopen(file, "w")) == NULL) {
+    perror(file);
+    return -1;
+  }
+
+  return 0;
+}
+
+/****************************************************************
+ * trace_write (header written with the first edge)
+ ****************************************************************/
+
+int trace_write(struct trace *t, struct gpio_edge *e)
+{
+  struct trace_header h;
+  int64_t dt;
+  uint32_t rec;
+
+  if (!t->f)
+    return 0;
+
+  if (t->nedges == 0) {
+    h.magic = TRACE_MAGIC;
+    h.version = TRACE_VERSION;
+    h.start = e->ts;
+    if (fwrite(&h, sizeof(h), 1, t->f) != 1)
+      return -1;
+    t->last = e->ts;
+  }
+
+  dt = (e->ts - t->last) / 1000;
+  if (dt < 0)
+    dt = 0;
+  if (dt > TRACE_DT_MAX)
+    dt = TRACE_DT_MAX;
+
+  rec = (uint32_t)dt | (e->value ? TRACE_LEVEL : 0);
+  t->last += dt * 1000;
+  t->nedges++;
+
+  return fwrite(&rec, sizeof(rec), 1, t->f) == 1 ? 0 : -1;
+}
+
+/****************************************************************
+ * trace_open_read
+ ****************************************************************/
+
+int trace_open_read(struct trace *t, char *file)
+{
+  struct trace_header h;
+
+  memset(t, 0, sizeof(*t));
+
+  if ((t->f = fopen(file, "r")) == NULL) {
+    perror(file);
+    return -1;
+  }
+
+  if (fread(&h, sizeof(h), 1, t->f) != 1 || h.magic != TRACE_MAGIC || h.version != TRACE_VERSION) {
+    fprintf(stderr, "%s: not a trace file\n", file);
+    fclose(t->f);
+    t->f = NULL;
+    return -1;
+  }
+
+  t->last = h.start;
+
+  return 0;
+}
+
+/****************************************************************
+ * trace_read (1 -> edge, 0 -> end of trace)
+ ****************************************************************/
+
+int trace_read(struct trace *t, struct gpio_edge *e)
+{
+  uint32_t rec;
+
+  if (fread(&rec, sizeof(rec), 1, t->f) != 1)
+    return 0;
+
+  t->last += (int64_t)(rec & TRACE_DT_MAX) * 1000;
+  t->nedges++;
+
+  e->ts = t->last;
+  e->value = (rec & TRACE_LEVEL) ? 1 : 0;
+
+  return 1;
+}
+
+/****************************************************************
+ * trace_close
+ ****************************************************************/
+
+void trace_close(struct trace *t)
+{
+  if (t->f)
+    fclose(t->f);
+
+  t->f = NULL;
+}
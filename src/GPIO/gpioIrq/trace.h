@@ -0,0 +1,40 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "gpio.h"
+
+/****************************************************************
+ * Sensor edge trace (gpioIrq -R, beat_bench -t)
+ *
+ * Header, then 4 bytes per edge: bit 31 = level, bits 0-30 = time
+ * since the previous edge in us (saturated, ~35 min).
+ ****************************************************************/
+
+#define TRACE_MAGIC   0x54525950  /* "PYRT" */
+#define TRACE_VERSION 1
+
+#define TRACE_LEVEL   0x80000000U
+#define TRACE_DT_MAX  0x7fffffffU
+
+struct trace_header {
+  uint32_t magic;
+  uint32_t version;
+  int64_t start;      /* CLOCK_MONOTONIC of the first edge, ns */
+};
+
+struct trace {
+  FILE *f;
+  int64_t last;       /* previous edge, ns */
+  int nedges;
+};
+
+int trace_open_write(struct trace *t, char *file);
+int trace_write(struct trace *t, struct gpio_edge *e);
+int trace_open_read(struct trace *t, char *file);
+int trace_read(struct trace *t, struct gpio_edge *e);
+void trace_close(struct trace *t);
+
+#endif /* TRACE_H */
@@ -0,0 +1,482 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include "dma.h"
+
+/* VideoCore mailbox: DMA-able (physically contiguous, uncached) memory */
+#define MBOX_DEV        "/dev/vcio"
+#define MBOX_IOCTL      _IOWR(100, 0, char *)
+#define MBOX_MEM_ALLOC  0x3000c
+#define MBOX_MEM_LOCK   0x3000d
+#define MBOX_MEM_UNLOCK 0x3000e
+#define MBOX_MEM_FREE   0x3000f
+#define MEM_FLAG_DIRECT       0x04   /* 0xC0000000 alias, uncached */
+#define MEM_FLAG_L1_NONALLOC  0x0c   /* Pi 1 */
+#define BUS_TO_PHYS(a)  ((a) & ~0xC0000000)
+#define SIM_BUS_BASE    0xC0000000
+
+/* PWM registers (32 bit words) */
+#define PWM_CTL        0
+#define PWM_DMAC       2
+#define PWM_RNG1       4
+#define PWM_CTL_PWEN1  (1 << 0)
+#define PWM_CTL_MODE1  (1 << 1)
+#define PWM_CTL_USEF1  (1 << 5)
+#define PWM_CTL_CLRF1  (1 << 6)
+#define PWM_DMAC_ENAB  (1U << 31)
+#define PWM_DMAC_THRESHOLD ((15 << 8) | 15)
+
+/* clock manager, PWM clock from PLLD */
+#define CLK_PWMCTL     (0xa0 / 4)
+#define CLK_PWMDIV     (0xa4 / 4)
+#define CLK_PASSWD     0x5a000000
+#define CLK_SRC_PLLD   6
+#define CLK_ENAB       (1 << 4)
+#define CLK_BUSY       (1 << 7)
+#define PWM_CLK_HZ     10000000      /* RNG1 = DMA_TICK_NS / 100 */
+
+/* one beat: control blocks + the GPSET/GPCLR masks they copy */
+struct dma_chain {
+  struct dma_cb cb[4 * DMA_STEPS_MAX];
+  uint32_t mask[DMA_STEPS_MAX][4];   /* set0 set1 clr0 clr1 */
+  uint32_t pace;                     /* word fed to the PWM FIFO */
+  int ncb;
+  int64_t ticks;                     /* beat length */
+};
+
+static int dma_backend;
+static int dma_chan;
+static volatile uint32_t *dma_base, *dma_reg, *pwm_reg, *clk_reg;
+static struct dma_chain *chain;      /* [2], ping-pong */
+static uint32_t chain_bus;           /* bus address of chain[0] */
+static size_t chain_size;
+static int cur = -1;                 /* chain the DMA runs */
+static int mbox_fd = -1;
+static uint32_t mbox_handle;
+
+static uint32_t bus(void *v)
+{
+  return chain_bus + (uint32_t)((char *)v - (char *)chain);
+}
+
+static void *virt(uint32_t b)
+{
+  return (char *)chain + (b - chain_bus);
+}
+
+/****************************************************************
+ * Mailbox (one tag per call, returns the first value word)
+ ****************************************************************/
+
+static uint32_t mbox_call(uint32_t tag, int n, uint32_t a, uint32_t b, uint32_t c)
+{
+  uint32_t m[16] __attribute__((aligned(16)));
+  int i = 0;
+
+  m[i++] = 0;          /* size */
+  m[i++] = 0;          /* request */
+  m[i++] = tag;
+  m[i++] = n * 4;
+  m[i++] = n * 4;
+  m[i++] = a;
+  m[i++] = b;
+  m[i++] = c;
+  i = 5 + n;
+  m[i++] = 0;          /* end tag */
+  m[0] = i * 4;
+
+  if (ioctl(mbox_fd, MBOX_IOCTL, m) < 0) {
+    perror("dma/mailbox");
+    return 0;
+  }
+
+  return m[5];
+}
+
+static volatile uint32_t *peri_map(int fd, unsigned long addr, size_t size)
+{
+  void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, addr);
+
+  if (map == MAP_FAILED) {
+    perror("dma/mmap");
+    return NULL;
+  }
+
+  return map;
+}
+
+/****************************************************************
+ * dma_open
+ *
+ * DMA_HW: map the DMA/PWM/clock blocks, get the chain memory from the
+ * mailbox, clock the PWM at PWM_CLK_HZ with one FIFO word per tick.
+ * DMA_SIM: the same on calloc()ed registers and memory.
+ ****************************************************************/
+
+int dma_open(int backend, int chan)
+{
+  unsigned long base;
+  uint32_t div;
+  int fd;
+
+  if (chan < 0 || chan > 14) {
+    fprintf(stderr, "dma: bad channel %d\n", chan);
+    return -1;
+  }
+
+  dma_backend = backend;
+  dma_chan = chan;
+  chain_size = (2 * sizeof(struct dma_chain) + 4095) & ~4095UL;
+
+  if (backend == DMA_SIM) {
+    dma_base = calloc(1, 4096);
+    pwm_reg = calloc(1, 4096);
+    clk_reg = calloc(1, 4096);
+    chain = aligned_alloc(4096, chain_size);
+    if (!dma_base || !pwm_reg || !clk_reg || !chain) {
+      perror("dma/calloc");
+      return -1;
+    }
+    memset(chain, 0, chain_size);
+    chain_bus = SIM_BUS_BASE;
+  }
+  else {
+    base = bcm_peri_base();
+
+    if ((fd = open("/dev/mem", O_RDWR | O_SYNC | O_CLOEXEC)) < 0) {
+      perror("dma/open /dev/mem");
+      return -1;
+    }
+    dma_base = peri_map(fd, base + DMA_OFFSET, 4096);
+    pwm_reg = peri_map(fd, base + PWM_OFFSET, 4096);
+    clk_reg = peri_map(fd, base + CLK_OFFSET, 4096);
+
+    if ((mbox_fd = open(MBOX_DEV, O_RDWR | O_CLOEXEC)) < 0)
+      perror("dma/open " MBOX_DEV);
+    else if ((mbox_handle = mbox_call(MBOX_MEM_ALLOC, 3, chain_size, 4096,
+				      base == BCM_PERI_BASE_PI1 ? MEM_FLAG_L1_NONALLOC : MEM_FLAG_DIRECT)) == 0)
+      fprintf(stderr, "dma: mailbox alloc failed\n");
+    else if ((chain_bus = mbox_call(MBOX_MEM_LOCK, 1, mbox_handle, 0, 0)) == 0)
+      fprintf(stderr, "dma: mailbox lock failed\n");
+    else
+      chain = (void *)peri_map(fd, BUS_TO_PHYS(chain_bus), chain_size);
+    close(fd);
+
+    if (!dma_base || !pwm_reg || !clk_reg || !chain)
+      return -1;
+  }
+
+  dma_reg = dma_base + chan * DMA_CHAN_SIZE / 4;
+  dma_base[DMA_ENABLE] |= 1 << chan;
+  dma_reg[DMA_CS] = DMA_CS_RESET;
+  usleep(10);
+
+  // PWM clock: PLLD is 500 MHz (750 MHz on the Pi 4)
+  div = (bcm_peri_base() == BCM_PERI_BASE_PI4 ? 750000000 : 500000000) / PWM_CLK_HZ;
+  pwm_reg[PWM_CTL] = 0;
+  usleep(10);
+  clk_reg[CLK_PWMCTL] = CLK_PASSWD | CLK_SRC_PLLD;
+  while (backend == DMA_HW && (clk_reg[CLK_PWMCTL] & CLK_BUSY))
+    usleep(10);
+  clk_reg[CLK_PWMDIV] = CLK_PASSWD | (div << 12);
+  clk_reg[CLK_PWMCTL] = CLK_PASSWD | CLK_SRC_PLLD | CLK_ENAB;
+  usleep(10);
+
+  // one FIFO word drained per range, i.e. per tick, DREQ to the DMA
+  pwm_reg[PWM_RNG1] = DMA_TICK_NS / (1000000000 / PWM_CLK_HZ);
+  pwm_reg[PWM_DMAC] = PWM_DMAC_ENAB | PWM_DMAC_THRESHOLD;
+  pwm_reg[PWM_CTL] = PWM_CTL_CLRF1;
+  usleep(10);
+  pwm_reg[PWM_CTL] = PWM_CTL_USEF1 | PWM_CTL_MODE1 | PWM_CTL_PWEN1;
+
+  return 0;
+}
+
+/****************************************************************
+ * dma_build (timeline -> looping chain of control blocks)
+ ****************************************************************/
+
+static struct dma_cb *dma_cb_add(struct dma_chain *c)
+{
+  struct dma_cb *cb = &c->cb[c->ncb++];
+
+  memset(cb, 0, sizeof(*cb));
+
+  return cb;
+}
+
+static int dma_delay(struct dma_chain *c, int64_t ticks)
+{
+  struct dma_cb *cb;
+  int64_t t;
+
+  for ( ; ticks > 0 ; ticks -= t) {
+    if (c->ncb == 4 * DMA_STEPS_MAX)
+      return -1;
+    t = ticks > DMA_DELAY_MAX ? DMA_DELAY_MAX : ticks;
+    cb = dma_cb_add(c);
+    cb->ti = DMA_TI_NO_WIDE | DMA_TI_WAIT_RESP | DMA_TI_DEST_DREQ | DMA_TI_PERMAP(DMA_PERMAP_PWM);
+    cb->src = bus(&c->pace);
+    cb->dst = BUS_PWM_FIF1;
+    cb->len = 4 * t;
+  }
+
+  return 0;
+}
+
+static void dma_write(struct dma_chain *c, uint32_t *mask, uint32_t dst)
+{
+  struct dma_cb *cb = dma_cb_add(c);
+
+  cb->ti = DMA_TI_NO_WIDE | DMA_TI_WAIT_RESP | DMA_TI_SRC_INC | DMA_TI_DEST_INC;
+  cb->src = bus(mask);
+  cb->dst = dst;
+  cb->len = 4 * PULSE_BANKS;
+}
+
+static int dma_build(struct dma_chain *c, struct pulse_step *s, int n, int64_t cycle)
+{
+  int64_t t, prev = 0;
+  int i;
+
+  c->ncb = 0;
+  c->ticks = (cycle + DMA_TICK_NS / 2) / DMA_TICK_NS;
+
+  for (i = 0 ; i < n ; i++) {
+    t = (s[i].at + DMA_TICK_NS / 2) / DMA_TICK_NS;
+    if (dma_delay(c, t - prev) < 0 || c->ncb > 4 * DMA_STEPS_MAX - 2)
+      return -1;
+    prev = t;
+
+    memcpy(c->mask[i], s[i].set, sizeof(s[i].set));
+    memcpy(c->mask[i] + 2, s[i].clr, sizeof(s[i].clr));
+    if (s[i].set[0] | s[i].set[1])
+      dma_write(c, c->mask[i], BUS_GPSET0);
+    if (s[i].clr[0] | s[i].clr[1])
+      dma_write(c, c->mask[i] + 2, BUS_GPCLR0);
+  }
+
+  if (dma_delay(c, c->ticks - prev) < 0)
+    return -1;
+  if (c->ncb == 0 && dma_delay(c, 1) < 0)
+    return -1;
+
+  for (i = 0 ; i < c->ncb - 1 ; i++)
+    c->cb[i].next = bus(&c->cb[i + 1]);
+  c->cb[c->ncb - 1].next = bus(&c->cb[0]);
+
+  return 0;
+}
+
+/* the DMA is in chain i */
+static int dma_in_chain(int i)
+{
+  uint32_t a = dma_reg[DMA_CONBLK_AD];
+
+  return a >= bus(&chain[i]) && a < bus(&chain[i + 1]);
+}
+
+/****************************************************************
+ * dma_load
+ *
+ * Build the beat of the outputs (all at 'cycle') in the idle chain
+ * and switch to it at the end of the running beat. 1 if the chain
+ * to overwrite is still running (two loads within one beat): retry.
+ ****************************************************************/
+
+int dma_load(struct pulse *p, int64_t cycle)
+{
+  static struct pulse_step steps[DMA_STEPS_MAX];
+  struct dma_chain *c, *old;
+  int n, next = (cur < 0 ? 0 : !cur);
+
+  if ((n = pulse_timeline(p, cycle, steps, DMA_STEPS_MAX)) < 0) {
+    fprintf(stderr, "dma: outputs need the same period, %d edges per beat max\n", DMA_STEPS_MAX);
+    return -1;
+  }
+
+  if (cur >= 0 && dma_in_chain(next))
+    return 1;
+
+  c = &chain[next];
+  if (dma_build(c, steps, n, cycle) < 0) {
+    fprintf(stderr, "dma: too many control blocks\n");
+    return -1;
+  }
+  __sync_synchronize();
+
+  if (cur < 0) {
+    dma_reg[DMA_CONBLK_AD] = bus(&c->cb[0]);
+    dma_reg[DMA_CS] = DMA_CS_WAIT_WRITES | DMA_CS_PANIC(8) | DMA_CS_PRIO(8) | DMA_CS_ACTIVE;
+  }
+  else {
+    // the running beat ends in the new chain
+    old = &chain[cur];
+    old->cb[old->ncb - 1].next = bus(&c->cb[0]);
+  }
+  cur = next;
+
+  return 0;
+}
+
+/****************************************************************
+ * dma_close
+ ****************************************************************/
+
+void dma_close(void)
+{
+  if (!dma_reg)
+    return;
+
+  dma_reg[DMA_CS] = DMA_CS_RESET;
+  pwm_reg[PWM_CTL] = 0;
+  cur = -1;
+
+  if (dma_backend == DMA_HW) {
+    munmap(chain, chain_size);
+    if (mbox_fd >= 0) {
+      mbox_call(MBOX_MEM_UNLOCK, 1, mbox_handle, 0, 0);
+      mbox_call(MBOX_MEM_FREE, 1, mbox_handle, 0, 0);
+      close(mbox_fd);
+    }
+  }
+}
+
+/****************************************************************
+ * Simulation
+ *
+ * sim_cb() executes the control block at CONBLK_AD as the DMA engine
+ * would: GPSET/GPCLR writes go to the (fake) GPIO registers and are
+ * recorded, PWM FIFO writes advance the time by one tick per word.
+ ****************************************************************/
+
+struct sim_ev {
+  int64_t t;           /* ticks from the beat start */
+  uint32_t set[PULSE_BANKS], clr[PULSE_BANKS];
+};
+
+static int64_t sim_t, sim_start;   /* ticks */
+
+static void sim_cb(struct sim_ev *ev, int *nev, int max)
+{
+  struct dma_cb *c = virt(dma_reg[DMA_CONBLK_AD]);
+  uint32_t *w = virt(c->src);
+  int b;
+
+  if (c->dst == BUS_GPSET0 || c->dst == BUS_GPCLR0) {
+    for (b = 0 ; b < PULSE_BANKS ; b++)
+      bcm_gpio_write_mask(b, c->dst == BUS_GPSET0 ? w[b] : 0, c->dst == BUS_GPCLR0 ? w[b] : 0);
+
+    // writes of the same tick make one step
+    if (ev && *nev < max) {
+      if (!*nev || ev[*nev - 1].t != sim_t - sim_start) {
+	memset(&ev[*nev], 0, sizeof(ev[*nev]));
+	ev[(*nev)++].t = sim_t - sim_start;
+      }
+      memcpy(c->dst == BUS_GPSET0 ? ev[*nev - 1].set : ev[*nev - 1].clr, w, 4 * PULSE_BANKS);
+    }
+  }
+  else if (c->dst == BUS_PWM_FIF1 && (c->ti & DMA_TI_DEST_DREQ))
+    sim_t += c->len / 4;
+
+  dma_reg[DMA_CONBLK_AD] = c->next;
+}
+
+/* run until the DMA is at the first block of chain i, -1 if it never gets there */
+static int sim_run_to(int i, struct sim_ev *ev, int *nev, int max)
+{
+  int n;
+
+  for (n = 0 ; n < 64 * DMA_STEPS_MAX ; n++) {
+    if (dma_reg[DMA_CONBLK_AD] == bus(&chain[i].cb[0]) && (n || !ev))
+      return 0;
+    sim_cb(ev, nev, max);
+  }
+
+  return -1;
+}
+
+/****************************************************************
+ * dma_sim_verify
+ *
+ * Load each cycle in turn (the outputs follow it) and check, from
+ * the control blocks only: the switch happens exactly at the end of
+ * the previous beat, each beat lasts the cycle and writes the masks
+ * of pulse_timeline() at the right ticks. Returns the error count.
+ ****************************************************************/
+
+int dma_sim_verify(struct pulse *p, int64_t *cycles, int ncycles, int verbose)
+{
+  static struct pulse_step steps[DMA_STEPS_MAX];
+  static struct sim_ev ev[DMA_STEPS_MAX];
+  int64_t expect = 0, t;
+  int i, j, k, n, nev, errors = 0, beat;
+
+  for (k = 0 ; k < ncycles ; k++) {
+    for (i = 0 ; i < p->n ; i++)
+      pulse_set_cycle(&p->ch[i], cycles[k]);
+    pulse_apply(p);
+
+    // busy: let the previous beat run out
+    while ((n = dma_load(p, cycles[k])) == 1)
+      sim_cb(NULL, NULL, 0);
+    if (n < 0)
+      return errors + 1;
+
+    n = pulse_timeline(p, cycles[k], steps, DMA_STEPS_MAX);
+
+    if (sim_run_to(cur, NULL, NULL, 0) < 0) {
+      fprintf(stderr, "dma sim: %lld ns: never entered the new chain\n", (long long)cycles[k]);
+      return errors + 1;
+    }
+    if (k && sim_t != expect) {
+      fprintf(stderr, "dma sim: %lld ns: switch at tick %lld, expected %lld\n", (long long)cycles[k],
+	      (long long)sim_t, (long long)expect);
+      errors++;
+    }
+
+    for (beat = 0 ; beat < 2 ; beat++) {
+      sim_start = sim_t;
+      nev = 0;
+      if (sim_run_to(cur, ev, &nev, DMA_STEPS_MAX) < 0) {
+	fprintf(stderr, "dma sim: %lld ns: chain does not loop\n", (long long)cycles[k]);
+	return errors + 1;
+      }
+
+      if (sim_t - sim_start != chain[cur].ticks) {
+	fprintf(stderr, "dma sim: %lld ns: beat of %lld ticks\n", (long long)cycles[k], (long long)(sim_t - sim_start));
+	errors++;
+      }
+
+      // expected steps, merged when they fall on the same tick
+      for (i = j = 0 ; i < n ; i++) {
+	t = (steps[i].at + DMA_TICK_NS / 2) / DMA_TICK_NS;
+	if (j >= nev || ev[j].t != t ||
+	    (steps[i].set[0] | steps[i].set[1]) & ~(ev[j].set[0] | ev[j].set[1]) ||
+	    (steps[i].clr[0] | steps[i].clr[1]) & ~(ev[j].clr[0] | ev[j].clr[1])) {
+	  if (errors++ < 10)
+	    fprintf(stderr, "dma sim: %lld ns: step %d at %lld ns not written\n", (long long)cycles[k], i, (long long)steps[i].at);
+	  continue;
+	}
+	if (i + 1 == n || (steps[i + 1].at + DMA_TICK_NS / 2) / DMA_TICK_NS != t)
+	  j++;
+      }
+      if (j != nev) {
+	fprintf(stderr, "dma sim: %lld ns: %d writes, %d expected\n", (long long)cycles[k], nev, j);
+	errors++;
+      }
+    }
+    expect = sim_t + chain[cur].ticks;
+
+    if (verbose)
+      printf ("dma sim: period %lld ns, %d steps, %d control blocks, %s\n", (long long)cycles[k] / 2, n,
+	      chain[cur].ncb, errors ? "FAILED" : "OK");
+  }
+
+  return errors;
+}
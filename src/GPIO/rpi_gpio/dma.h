@@ -0,0 +1,86 @@
+#ifndef DMA_H
+#define DMA_H
+
+#include <stdint.h>
+
+#include "pulse.h"
+#include "bcm_gpio.h"
+
+/****************************************************************
+ * DMA paced outputs (rpi_gpio -D)
+ *
+ * One beat of all the outputs (pulse_timeline()) becomes a looping
+ * chain of DMA control blocks: a block writing the GPSET0/1 masks, one
+ * writing the GPCLR0/1 masks, then a delay block writing N words into
+ * the PWM FIFO, which the PWM peripheral drains at one word per
+ * DMA_TICK_NS (DREQ pacing). The CPU only builds a new chain when the
+ * bpm changes: it is written in the idle half of the buffer and the
+ * running chain is pointed to it at its last block, so the switch
+ * happens at a beat boundary.
+ *
+ * Timing resolution is DMA_TICK_NS; all the edges come out
+ * DMA_FIFO_DEPTH ticks late (PWM FIFO filled ahead), a constant.
+ *
+ * DMA_SIM runs the same code on plain memory with fake bus addresses,
+ * dma_sim_verify() then walks the control blocks like the DMA engine
+ * does and checks the GPIO writes against pulse_timeline() (x86, CI).
+ ****************************************************************/
+
+#define DMA_HW   0
+#define DMA_SIM  1
+
+#define DMA_CHANNEL_DEFAULT 5
+#define DMA_TICK_NS         10000     /* 10 us */
+#define DMA_FIFO_DEPTH      8
+#define DMA_STEPS_MAX       1024      /* timeline steps per beat */
+#define DMA_DELAY_MAX       16000     /* ticks per delay block (lite channels: 64 KB) */
+#define DMA_RETRY_US        20000     /* previous chain still running */
+
+/* peripherals, offsets from the base and bus addresses */
+#define DMA_OFFSET       0x007000
+#define DMA_CHAN_SIZE    0x100
+#define DMA_ENABLE       (0xff0 / 4)
+#define PWM_OFFSET       0x20C000
+#define CLK_OFFSET       0x101000
+#define BUS_PERI_BASE    0x7E000000
+#define BUS_GPSET0       (BUS_PERI_BASE + BCM_GPIO_OFFSET + 4 * BCM_GPSET0)
+#define BUS_GPCLR0       (BUS_PERI_BASE + BCM_GPIO_OFFSET + 4 * BCM_GPCLR0)
+#define BUS_PWM_FIF1     (BUS_PERI_BASE + PWM_OFFSET + 0x18)
+
+/* DMA control block (32 byte aligned) */
+struct dma_cb {
+  uint32_t ti;
+  uint32_t src;
+  uint32_t dst;
+  uint32_t len;
+  uint32_t stride;
+  uint32_t next;
+  uint32_t pad[2];
+} __attribute__((aligned(32)));
+
+/* TI bits */
+#define DMA_TI_WAIT_RESP  (1 << 3)
+#define DMA_TI_DEST_INC   (1 << 4)
+#define DMA_TI_DEST_DREQ  (1 << 6)
+#define DMA_TI_SRC_INC    (1 << 8)
+#define DMA_TI_PERMAP(x)  ((x) << 16)
+#define DMA_TI_NO_WIDE    (1 << 26)
+#define DMA_PERMAP_PWM    5
+
+/* channel registers (32 bit words) and CS bits */
+#define DMA_CS        0
+#define DMA_CONBLK_AD 1
+#define DMA_CS_ACTIVE (1 << 0)
+#define DMA_CS_END    (1 << 1)
+#define DMA_CS_PRIO(x)  ((x) << 16)
+#define DMA_CS_PANIC(x) ((x) << 20)
+#define DMA_CS_WAIT_WRITES (1 << 28)
+#define DMA_CS_RESET  (1U << 31)
+
+int dma_open(int backend, int chan);
+int dma_load(struct pulse *p, int64_t cycle);   /* 0, 1 busy, -1 error */
+void dma_close(void);
+
+int dma_sim_verify(struct pulse *p, int64_t *cycles, int n, int verbose);
+
+#endif /* DMA_H */
@@ -0,0 +1,77 @@
+#include "pll.h"
+
+#define PLL_CYCLE_MIN (60000000000LL / PLL_BPM_MAX)
+#define PLL_CYCLE_MAX (60000000000LL / PLL_BPM_MIN)
+
+static int pll_valid(int64_t cycle)
+{
+  return cycle >= PLL_CYCLE_MIN && cycle <= PLL_CYCLE_MAX;
+}
+
+/****************************************************************
+ * pll_beat
+ *
+ * One master beat (CLOCK_REALTIME), ibi_ns the interval since the
+ * previous one (0 -> unknown), cycle_hint the cycle of the announced
+ * bpm (0 -> none). Returns -1 if the event is not used (older than the
+ * last one, no cycle known yet), 1 if the grid was (re)started.
+ ****************************************************************/
+
+int pll_beat(struct pll *p, int64_t beat_ns, int64_t ibi_ns, int64_t cycle_hint)
+{
+  int64_t k, pred;
+
+  if (beat_ns <= p->last)
+    return -1;
+
+  if (!pll_valid(ibi_ns))
+    ibi_ns = 0;
+
+  // (re)start: the grid goes through this beat
+  if (!p->epoch || beat_ns - p->last > PLL_LOST_BEATS * p->cycle) {
+    if (ibi_ns)
+      p->cycle = ibi_ns;
+    else if (pll_valid(cycle_hint))
+      p->cycle = cycle_hint;
+    else if (!p->cycle)
+      return -1;
+
+    p->epoch = p->last = beat_ns;
+    p->err = 0;
+    p->resets++;
+    p->beats++;
+
+    return 1;
+  }
+
+  // nearest predicted beat
+  k = (beat_ns - p->epoch + p->cycle / 2) / p->cycle;
+  if (beat_ns < p->epoch)
+    k = -((p->epoch - beat_ns + p->cycle / 2) / p->cycle);
+  pred = p->epoch + k * p->cycle;
+  p->err = beat_ns - pred;
+
+  p->epoch = pred + (int64_t)(PLL_KP * p->err);
+  p->cycle += (int64_t)(PLL_KI * p->err);
+  if (ibi_ns)
+    p->cycle += (int64_t)(PLL_KF * (ibi_ns - p->cycle));
+
+  if (p->cycle < PLL_CYCLE_MIN)
+    p->cycle = PLL_CYCLE_MIN;
+  if (p->cycle > PLL_CYCLE_MAX)
+    p->cycle = PLL_CYCLE_MAX;
+
+  p->last = beat_ns;
+  p->beats++;
+
+  return 0;
+}
+
+/****************************************************************
+ * pll_cycle (predicted cycle for the outputs, PLL_QUANTUM_NS steps)
+ ****************************************************************/
+
+int64_t pll_cycle(struct pll *p)
+{
+  return (p->cycle + PLL_QUANTUM_NS / 2) / PLL_QUANTUM_NS * PLL_QUANTUM_NS;
+}
@@ -0,0 +1,42 @@
+#ifndef PLL_H
+#define PLL_H
+
+#include <stdint.h>
+
+/****************************************************************
+ * Beat predictor (rpi_gpio -P with beat events, see wire.h)
+ *
+ * A small phase-locked loop on the master beats: the beat grid
+ * (epoch + k x cycle, CLOCK_REALTIME) is corrected by each event, by
+ * PLL_KP of the phase error and PLL_KI of it on the cycle, the beat
+ * interval of the event being blended in by PLL_KF. The outputs follow
+ * the grid (pulse_align()), so they beat at the predicted time of the
+ * next master beat instead of when a message arrives: the network and
+ * queue latency only delays the corrections.
+ *
+ * No event: nothing changes, the outputs free-run on the last grid.
+ * Events back after more than PLL_LOST_BEATS beats: the grid restarts
+ * from the event (the outputs slew to it).
+ ****************************************************************/
+
+#define PLL_KP          0.5
+#define PLL_KI          0.1
+#define PLL_KF          0.25
+#define PLL_LOST_BEATS  8
+#define PLL_BPM_MIN     20
+#define PLL_BPM_MAX     200
+#define PLL_QUANTUM_NS  1000000    /* cycle given to the outputs: 1 ms steps (wave tables cache) */
+
+struct pll {
+  int64_t epoch;       /* CLOCK_REALTIME of a predicted beat, 0 -> not locked */
+  int64_t cycle;       /* ns, predicted beat interval */
+  int64_t last;        /* last master beat used */
+  int64_t err;         /* ns, last master beat - predicted beat */
+  uint64_t beats;      /* events used */
+  uint64_t resets;     /* grid (re)started from an event */
+};
+
+int pll_beat(struct pll *p, int64_t beat_ns, int64_t ibi_ns, int64_t cycle_hint);
+int64_t pll_cycle(struct pll *p);
+
+#endif /* PLL_H */
@@ -0,0 +1,386 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pulse.h"
+#include "bcm_gpio.h"
+
+/****************************************************************
+ * Heap (on pulse_ch.next)
+ ****************************************************************/
+
+#define NEXT(p, i) ((p)->ch[(p)->heap[i]].next)
+
+static void heap_swap(struct pulse *p, int i, int j)
+{
+  int t = p->heap[i];
+
+  p->heap[i] = p->heap[j];
+  p->heap[j] = t;
+}
+
+static void heap_down(struct pulse *p, int i)
+{
+  int c;
+
+  while ((c = 2 * i + 1) < p->n) {
+    if (c + 1 < p->n && NEXT(p, c + 1) < NEXT(p, c))
+      c++;
+    if (NEXT(p, i) <= NEXT(p, c))
+      break;
+    heap_swap(p, i, c);
+    i = c;
+  }
+}
+
+/****************************************************************
+ * pulse_add
+ ****************************************************************/
+
+struct pulse_ch *pulse_add(struct pulse *p, unsigned int gpio, int64_t cycle, int duty, int64_t phase)
+{
+  struct pulse_ch *ch;
+
+  if (p->n == PULSE_MAX || gpio >= 32 * PULSE_BANKS || duty < 0 || duty > 100) {
+    fprintf(stderr, "pulse: bad channel %u (max %d)\n", gpio, PULSE_MAX);
+    return NULL;
+  }
+
+  ch = &p->ch[p->n];
+  memset(ch, 0, sizeof(*ch));
+  ch->gpio = gpio;
+  ch->cycle = cycle;
+  ch->duty = duty;
+  ch->phase = phase;
+  p->heap[p->n] = p->n;
+  p->n++;
+
+  return ch;
+}
+
+/****************************************************************
+ * pulse_parse
+ *
+ * "<gpio>[:<period-ns>[:<duty%>[:<phase-ns>]]]", period as -p (half
+ * cycle). No period (or 0) -> follow -p and its updates.
+ ****************************************************************/
+
+int pulse_parse(struct pulse *p, char *spec)
+{
+  unsigned long long period = 0;
+  long long phase = 0;
+  unsigned int gpio;
+  int duty = 50, n;
+  struct pulse_ch *ch;
+
+  n = sscanf(spec, "%u:%llu:%d:%lld", &gpio, &period, &duty, &phase);
+  if (n < 1)
+    return -1;
+
+  if ((ch = pulse_add(p, gpio, 2 * (int64_t)period, duty, phase)) == NULL)
+    return -1;
+  ch->follow = (period == 0);
+
+  return 0;
+}
+
+/****************************************************************
+ * pulse_set_cycle
+ *
+ * New cycle for a channel, from its next edge (square) or its next
+ * beat (waveform). The table is looked up / built here, outside of
+ * pulse_run(): call it after pulse_write().
+ ****************************************************************/
+
+int pulse_set_cycle(struct pulse_ch *ch, int64_t cycle)
+{
+  if (ch->shape != WAVE_SQUARE) {
+    wave_put(ch->new_wave);
+    if ((ch->new_wave = wave_get(ch->shape, cycle)) == NULL)
+      return -1;
+  }
+
+  ch->new_cycle = cycle;
+
+  return 0;
+}
+
+/****************************************************************
+ * pulse_start (first rising edge of each channel at now + phase)
+ ****************************************************************/
+
+void pulse_start(struct pulse *p, int64_t now)
+{
+  struct pulse_ch *ch;
+  int i;
+
+  for (i = 0 ; i < p->n ; i++) {
+    ch = &p->ch[i];
+    if (ch->shape != WAVE_SQUARE && !ch->wave) {
+      ch->wave = ch->new_wave ? ch->new_wave : wave_get(ch->shape, ch->cycle);
+      ch->new_wave = NULL;
+      ch->new_cycle = 0;
+      if (!ch->wave)
+	ch->shape = WAVE_SQUARE;
+    }
+
+    ch->start = now + ch->phase;
+    ch->shift = 0;
+    ch->step = 0;
+    ch->next = ch->start + (ch->wave ? ch->wave->at[0] : 0);
+    ch->level = ch->wave ? ch->wave->level[0] : (ch->duty > 0);
+    p->heap[i] = i;
+  }
+
+  for (i = p->n / 2 - 1 ; i >= 0 ; i--)
+    heap_down(p, i);
+}
+
+/****************************************************************
+ * pulse_mask (level of ch->gpio at this wakeup)
+ ****************************************************************/
+
+static inline void pulse_mask(struct pulse *p, struct pulse_ch *ch, int level)
+{
+  int bank = ch->gpio / 32;
+  uint32_t bit = 1U << (ch->gpio % 32);
+
+  if (level) {
+    p->set[bank] |= bit;
+    p->clr[bank] &= ~bit;
+  }
+  else {
+    p->clr[bank] |= bit;
+    p->set[bank] &= ~bit;
+  }
+}
+
+/****************************************************************
+ * pulse_wave_edge (next edge of the table, new cycle on wrap)
+ ****************************************************************/
+
+static void pulse_wave_edge(struct pulse *p, struct pulse_ch *ch, int64_t now)
+{
+  struct wave *w = ch->wave;
+  int64_t k;
+
+  pulse_mask(p, ch, w->level[ch->step]);
+  ch->edges++;
+
+  if (++ch->step == w->n) {
+    ch->step = 0;
+    ch->start += ch->cycle + ch->shift;
+    ch->shift = 0;
+
+    if (ch->new_cycle) {
+      wave_put(w);
+      ch->wave = w = ch->new_wave;
+      ch->cycle = ch->new_cycle;
+      ch->new_wave = NULL;
+      ch->new_cycle = 0;
+      if (!p->changed)
+	p->changed = ch->start;
+    }
+
+    if (now - ch->start > ch->cycle) {
+      k = (now - ch->start) / ch->cycle;
+      ch->start += k * ch->cycle;
+      ch->missed += k * w->n;
+    }
+  }
+
+  ch->next = ch->start + w->at[ch->step];
+}
+
+/****************************************************************
+ * pulse_edge
+ *
+ * Apply the edge at ch->next in the masks and schedule the following
+ * one. A new cycle takes effect from this edge on (no phase jump). If
+ * we are more than a cycle late, whole cycles are skipped and counted.
+ ****************************************************************/
+
+static void pulse_edge(struct pulse *p, struct pulse_ch *ch, int64_t now)
+{
+  int64_t high, k;
+  int changed = 0;
+
+  if (ch->wave) {
+    pulse_wave_edge(p, ch, now);
+    return;
+  }
+
+  if (ch->new_cycle) {
+    ch->cycle = ch->new_cycle;
+    ch->new_cycle = 0;
+    changed = 1;
+  }
+
+  pulse_mask(p, ch, ch->level);
+  ch->edges++;
+
+  // 0% / 100%: no edge inside the cycle. The pending phase shift goes
+  // to the next beat start (rising edge).
+  high = ch->cycle * ch->duty / 100;
+  if (ch->duty == 0 || ch->duty == 100) {
+    ch->start = ch->next;
+    ch->next += ch->cycle + ch->shift;
+    ch->shift = 0;
+  }
+  else if (ch->level) {
+    ch->start = ch->next;
+    ch->next += high;
+    ch->level = 0;
+  }
+  else {
+    ch->next += ch->cycle - high + ch->shift;
+    ch->shift = 0;
+    ch->level = 1;
+  }
+
+  if (now - ch->next > ch->cycle) {
+    k = (now - ch->next) / ch->cycle;
+    ch->next += k * ch->cycle;
+    ch->missed += 2 * k;
+  }
+
+  if (changed && !p->changed)
+    p->changed = ch->next;
+}
+
+/****************************************************************
+ * pulse_run
+ *
+ * Pop every edge due by now (+ PULSE_COALESCE_NS), returns the number
+ * of edges (*missed: skipped ones). Write the masks with pulse_write().
+ ****************************************************************/
+
+int pulse_run(struct pulse *p, int64_t now, uint64_t *missed)
+{
+  struct pulse_ch *ch;
+  uint64_t m;
+  int n = 0;
+
+  memset(p->set, 0, sizeof(p->set));
+  memset(p->clr, 0, sizeof(p->clr));
+  p->changed = 0;
+  *missed = 0;
+
+  while (p->n && NEXT(p, 0) <= now + PULSE_COALESCE_NS) {
+    ch = &p->ch[p->heap[0]];
+    m = ch->missed;
+    pulse_edge(p, ch, now);
+    *missed += ch->missed - m;
+    heap_down(p, 0);
+    n++;
+  }
+
+  return n;
+}
+
+/****************************************************************
+ * pulse_write (one GPSET + one GPCLR store per bank used)
+ ****************************************************************/
+
+void pulse_write(struct pulse *p)
+{
+  int b;
+
+  for (b = 0 ; b < PULSE_BANKS ; b++)
+    if (p->set[b] | p->clr[b])
+      bcm_gpio_write_mask(b, p->set[b], p->clr[b]);
+}
+
+/****************************************************************
+ * pulse_apply (pending cycles now, when nothing runs pulse_run())
+ ****************************************************************/
+
+void pulse_apply(struct pulse *p)
+{
+  struct pulse_ch *ch;
+  int i;
+
+  for (i = 0 ; i < p->n ; i++) {
+    ch = &p->ch[i];
+    if (!ch->new_cycle)
+      continue;
+
+    if (ch->new_wave) {
+      wave_put(ch->wave);
+      ch->wave = ch->new_wave;
+      ch->new_wave = NULL;
+    }
+    ch->cycle = ch->new_cycle;
+    ch->new_cycle = 0;
+  }
+}
+
+/****************************************************************
+ * pulse_timeline
+ *
+ * Edges of one beat of all the channels (same cycle), as played by
+ * pulse_run() in steady state: a copy of the scheduler is run for two
+ * beats and the second one is kept, so edges wrapping over the beat
+ * end (phase, duty) are in. Returns the number of steps, -1 if the
+ * cycles differ or more than max steps.
+ ****************************************************************/
+
+int pulse_timeline(struct pulse *p, int64_t cycle, struct pulse_step *steps, int max)
+{
+  static struct pulse q;
+  uint64_t missed;
+  int64_t at;
+  int i, n = 0;
+
+  q = *p;
+  for (i = 0 ; i < q.n ; i++) {
+    if (q.ch[i].cycle != cycle || q.ch[i].new_cycle || (q.ch[i].shape != WAVE_SQUARE && !q.ch[i].wave))
+      return -1;
+  }
+
+  pulse_start(&q, 0);
+
+  while (q.n && (at = pulse_next(&q)) < 2 * cycle) {
+    pulse_run(&q, at, &missed);
+    if (at < cycle)
+      continue;
+    if (n == max)
+      return -1;
+
+    steps[n].at = at - cycle;
+    memcpy(steps[n].set, q.set, sizeof(q.set));
+    memcpy(steps[n].clr, q.clr, sizeof(q.clr));
+    n++;
+  }
+
+  return n;
+}
+
+/****************************************************************
+ * pulse_align
+ *
+ * Phase error of the current beat of ch against a reference grid
+ * (beats at epoch + k x cycle, + the channel phase), in [-cycle/2,
+ * cycle/2). The next beat start is moved to cancel it, by max_slew ns
+ * at most; max_slew 0: all at once and as a delay (first lock), so
+ * that no beat is cut short.
+ ****************************************************************/
+
+int64_t pulse_align(struct pulse_ch *ch, int64_t epoch, int64_t max_slew)
+{
+  int64_t e = (ch->start - ch->phase - epoch) % ch->cycle;
+
+  if (e < 0)
+    e += ch->cycle;
+
+  if (!max_slew)
+    ch->shift = e ? ch->cycle - e : 0;
+
+  if (e >= ch->cycle / 2)
+    e -= ch->cycle;
+
+  if (max_slew)
+    ch->shift = e > max_slew ? -max_slew : e < -max_slew ? max_slew : -e;
+
+  return e;
+}
@@ -0,0 +1,81 @@
+#ifndef PULSE_H
+#define PULSE_H
+
+#include <stdint.h>
+
+#include "wave.h"
+
+/****************************************************************
+ * Multi-pin pulse scheduler (one timer for all the outputs)
+ *
+ * Each channel is a GPIO with its own cycle, duty cycle and phase.
+ * Pending edges sit in a min-heap on their deadline (ns).
+ * pulse_run() pops every edge due by 'now' (+ PULSE_COALESCE_NS)
+ * into per bank GPSET/GPCLR masks: one wakeup and one store per bank
+ * serve all the pins, whatever their number.
+ *
+ * A channel with a waveform (wave.h) plays the edges of its table
+ * instead of a square wave; a new cycle then starts at the next beat.
+ *
+ * Deadlines are in the clock of the caller: CLOCK_MONOTONIC, or
+ * CLOCK_REALTIME when the beats are aligned on a reference grid
+ * (pulse_align(), phase shifts applied at the next beat).
+ ****************************************************************/
+
+#define PULSE_MAX         32
+#define PULSE_BANKS       2        /* GPIO 0-31, 32-53 */
+#define PULSE_COALESCE_NS 20000    /* edges this close share a wakeup */
+
+struct pulse_ch {
+  unsigned int gpio;
+  int64_t cycle;       /* ns, full period (2 x the rpi_gpio -p period) */
+  int duty;            /* % of the cycle high */
+  int64_t phase;       /* ns, first rising edge after pulse_start() */
+  int follow;          /* cycle follows -c / MQTT updates */
+  int shape;           /* WAVE_SQUARE -> duty cycle, no table */
+
+  int64_t next;        /* next edge deadline */
+  int level;           /* level set at 'next' */
+  int64_t new_cycle;   /* applied at the next edge, 0 -> none */
+
+  struct wave *wave, *new_wave;
+  int step;            /* next table edge */
+  int64_t start;       /* current beat start (rising edge / table start) */
+  int64_t shift;       /* ns added to the next beat start (phase slewing) */
+  uint64_t edges;
+  uint64_t missed;     /* edges skipped because we were late */
+};
+
+struct pulse {
+  struct pulse_ch ch[PULSE_MAX];
+  int n;
+  int heap[PULSE_MAX]; /* channel indexes, earliest 'next' first */
+
+  /* filled by pulse_run() */
+  uint32_t set[PULSE_BANKS], clr[PULSE_BANKS];
+  int64_t changed;     /* first edge at a new cycle, 0 -> none */
+};
+
+/* one step of a beat timeline (pulse_timeline(), DMA backend) */
+struct pulse_step {
+  int64_t at;          /* ns from the beat start */
+  uint32_t set[PULSE_BANKS], clr[PULSE_BANKS];
+};
+
+struct pulse_ch *pulse_add(struct pulse *p, unsigned int gpio, int64_t cycle, int duty, int64_t phase);
+int pulse_parse(struct pulse *p, char *spec);
+int pulse_set_cycle(struct pulse_ch *ch, int64_t cycle);
+void pulse_start(struct pulse *p, int64_t now);
+int pulse_run(struct pulse *p, int64_t now, uint64_t *missed);
+void pulse_write(struct pulse *p);
+void pulse_apply(struct pulse *p);
+int pulse_timeline(struct pulse *p, int64_t cycle, struct pulse_step *steps, int max);
+int64_t pulse_align(struct pulse_ch *ch, int64_t epoch, int64_t max_slew);
+
+/* deadline of the earliest pending edge */
+static inline int64_t pulse_next(struct pulse *p)
+{
+  return p->ch[p->heap[0]].next;
+}
+
+#endif /* PULSE_H */
@@ -8,175 +8,447 @@
 // 
 // PF: Fix mmap() error code + use POSIX.4 timer
 //
+// Toggling is driven by a CLOCK_MONOTONIC timerfd read from main(), no
+// more signal handler: edges missed while we were late are counted
+// (and the output phase is kept), not silently merged.
+//
+// Several outputs are driven by one process and one timer: -g can be
+// repeated, as <gpio>[:<period-ns>[:<duty%>[:<phase-ns>]]] (pulse.c).
+// The timer is armed on the earliest pending edge, all the edges due
+// at the wakeup go out as one GPSET/GPCLR store per bank. With
+// -s lubdub the outputs play a heartbeat waveform (common/wave.c,
+// tables built once per bpm) instead of a square wave.
+//
+// Jitter (wakeup time - edge deadline) goes to a lock-free histogram,
+// the reporter thread prints the percentiles (and dumps the histogram
+// at exit with -o).
+//
+// With -c <fifo> a new period (ns) can be written to the control FIFO
+// at any time: it is applied at the next edge, the following edges
+// being scheduled from that one (no gap, no phase jump, no restart).
+// It changes the outputs without a period of their own (-p ones).
+//
+// With -h <mqtt_host> -T <mqtt_topic> (USE_MOSQUITTO) rpi_gpio keeps one
+// subscription and takes the BPM from the messages the same way. Both
+// payload formats of common/wire.h are accepted: ASCII as before, binary
+// ones are dropped if out of order or older than -A <ms>, and give the
+// sender -> led latency (telemetry, pyramidion_stat).
+//
+// With -P <slew-%> the beats of the outputs that follow -p are put on
+// the grid of the master (epoch of a reference beat in the binary
+// messages, or "<period-ns> <epoch-ns>" on the control FIFO): the
+// timer then runs on CLOCK_REALTIME absolute deadlines (NTP / PTP
+// disciplined), the first beat after a (re)start or a clock set is
+// delayed onto the grid, then each beat is moved by at most slew % of
+// the cycle. The alignment error goes to the telemetry. If the master
+// streams beat events (gpioIrq -e), a predictor (pll.c) makes the grid
+// from them: the leds beat with the master's predicted next beat, not
+// a network delay behind, and free-run on the last grid without events.
+//
+// With -D <dma-chan> the CPU does not toggle anything: one beat of all
+// the outputs becomes a looping DMA control-block chain paced by the PWM
+// FIFO (dma.c, 10 us steps), main() only builds a new chain when the bpm
+// changes. -D sim checks the chains on fake registers for a few bpm and
+// exits (0: OK), for x86 / CI.
+//
+// The register mapping is in common/bcm_gpio.c: /dev/gpiomem or
+// /dev/mem at the peripheral base found at runtime (Pi 1 to 4), fake
+// registers with -F (default when not built for ARM).
+//
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <sys/mman.h>
+#include <sys/timerfd.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include <time.h>
 #include <signal.h>
 #include <libgen.h>
 #include <string.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+#include "rt.h"
+#include "hist.h"
+#include "telem.h"
+#include "bcm_gpio.h"
+#include "mqtt.h"
+#include "wire.h"
+#include "pulse.h"
+#include "dma.h"
+#include "pll.h"
+
+#define REPORT_PERIOD 2 /* sec */
+#define MAX_LINE 64
+
+#define MIN_BPM 1
+#define MAX_BPM 300
+#define BPM_TO_PERIOD(b) (30000000000ULL / (b))       /* ns, half of 60 s / bpm */
+#define MBPM_TO_PERIOD(m) (30000000000000ULL / (m))   /* same, from milli-bpm */
+#define PERIOD_VALID(p) ((p) >= BPM_TO_PERIOD(MAX_BPM) && (p) <= BPM_TO_PERIOD(MIN_BPM))
+
+int timer_fd;
+int gpio_nr = 4; /* led, if no -g */
+uint64_t period = 100000000; // default is 100 ms (64 bits: 30 s at 1 bpm)
+struct pulse pulse;             /* -g outputs */
+int shape = WAVE_SQUARE;        /* -s */
+int quiet = 0;
+int gpio_backend = BCM_GPIO_BACKEND_DEFAULT;   /* -F -> fake registers */
+int ml = 0;
+int rt_prio = 0;   /* SCHED_FIFO priority */
+int rt_cpu = -1;   /* CPU to pin to */
+int dma_chan = -1; /* -D, -1: outputs toggled by the CPU */
+int dma_sim = 0;   /* -D sim */
+int period_fd = -1;  /* eventfd, -D: set_period() wakes main() */
+int sync_slew = 0;   /* -P, % of the cycle per beat, 0 -> free running */
+clockid_t sched_clock = CLOCK_MONOTONIC;   /* CLOCK_REALTIME with -P */
+
+unsigned long test_loops = 0;   /* edges, missed included */
+int64_t t = 0;
+int ntest = 0, ntest_max;
+volatile sig_atomic_t stop = 0;
 
-// Pi 4
-//#define BCM_PERI_BASE 0xFE000000
-// Pi 3
-#define BCM_PERI_BASE   0x3F000000
-// Pi 1
-//#define BCM_PERI_BASE   0x20000000
+struct telem *telem;            /* /dev/shm/pyramidion-rpi_gpio */
+struct hist *jitter_hist;       /* in telem, filled by main(), read by reporter() */
+char *hist_file = NULL;
+pthread_t reporter_thread;
 
-#define GPIO_BASE           (BCM_PERI_BASE + 0x200000) /* GPIO controler */
+char *ctrl_fifo = NULL;
+uint64_t new_period = 0;        /* written by control(), 0 -> no change */
+int64_t new_sent = 0;           /* sender CLOCK_REALTIME of new_period, 0 -> unknown */
+int64_t new_epoch = 0;          /* CLOCK_REALTIME of a reference beat at new_period, 0 -> none */
+pthread_t control_thread;
 
-#define PAGE_SIZE (4*1024)
-#define BLOCK_SIZE (4*1024)
 
-int  mem_fd;
-char *gpio_map;
-timer_t my_timer;
-int gpio_nr = 4; /* led */
-unsigned long period = 100000000; // default is 100 ms
-int quiet = 0;
-int ml = 0;
+void got_sigint (int sig) 
+{
+  stop = 1;
+}
 
-unsigned long loop_prt;
-int test_loops = 0;             /* outer loop count */
-time_t t = 0, told = 0;
-int ntest = 0, ntest_max;
+// Jitter stats, called after the register writes (no I/O here)
+static inline void sample (int64_t late, uint64_t missed)
+{
+  hist_add (jitter_hist, late > 0 ? late : 0);
+  if (missed)
+    hist_missed (jitter_hist, missed);
+}
+
+// Reporter thread: display every REPORT_PERIOD, stop after -n reports
+void *reporter (void *arg)
+{
+  struct timespec next;
+  struct hist snap;
 
+  clock_gettime (CLOCK_MONOTONIC, &next);
 
-#ifndef __x86_64__
+  while (1) {
+    next.tv_sec += REPORT_PERIOD;
+    clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
 
-// I/O access
-volatile unsigned *gpio;
+    hist_snapshot (jitter_hist, &snap);
+    if (!quiet) {
+      printf ("Loop= %d jitter ", ntest + 1);
+      hist_print (stdout, &snap, HIST_FMT_TEXT);
+      fflush (stdout);
+    }
 
+    if (++ntest == ntest_max)
+      stop = 1;
+  }
 
-// GPIO setup macros. Always use INP_GPIO(x) before using OUT_GPIO(x) 
-#define INP_GPIO(g) *(gpio+((g)/10)) &= ~(7<<(((g)%10)*3))
-#define OUT_GPIO(g) *(gpio+((g)/10)) |=  (1<<(((g)%10)*3))
+  return NULL;
+}
 
-#define GPIO_SET *(gpio+7)  // sets   bits which are 1 ignores bits which are 0
-#define GPIO_CLR *(gpio+10) // clears bits which are 1 ignores bits which are 0
+// Apply a new period at the next edge (control FIFO or MQTT)
+void set_period (uint64_t p)
+{
+  uint64_t one = 1;
 
-// For GPIO# >= 32 (RPi B+)
-#define GPIO_SET_EXT *(gpio+8)  // sets   bits which are 1 ignores bits which are 0
-#define GPIO_CLR_EXT *(gpio+11) // clears bits which are 1 ignores bits which are 0
+  __atomic_store_n (&new_period, p, __ATOMIC_RELEASE);
+  if (period_fd >= 0)
+    write (period_fd, &one, sizeof(one));
+  if (!quiet)
+    printf ("New period %llu ns\n", (unsigned long long)p);
+}
 
-void gpio_set (int g)
+// Control thread: read new periods (ns, one per line) from the FIFO,
+// optionally followed by the CLOCK_REALTIME (ns) of a reference beat
+void *control (void *arg)
 {
-  if (g >= 32)
-    GPIO_SET_EXT = (1 << (g % 32));
-  else
-    GPIO_SET = (1 << g);
+  FILE *f;
+  char line[MAX_LINE], *cp;
+  uint64_t p;
+  int fd;
+
+  // O_RDWR: we are a writer too, so no EOF when the shell closes it
+  if ((fd = open (ctrl_fifo, O_RDWR)) < 0 || (f = fdopen (fd, "r")) == NULL) {
+    perror (ctrl_fifo);
+    return NULL;
+  }
+
+  while (fgets (line, sizeof(line), f)) {
+    p = strtoull (line, &cp, 0);
+    if (!p)
+      continue;
+
+    __atomic_store_n (&new_epoch, strtoll (cp, NULL, 0), __ATOMIC_RELAXED);
+    set_period (p);
+  }
+
+  return NULL;
 }
 
-void gpio_clr (int g)
+#ifdef USE_MOSQUITTO
+struct wire_rx wire_rx;
+int64_t max_age = 0;            /* -A <ms>, ns, 0 -> no check */
+struct pll pll;                 /* beat events (-P), MQTT thread only */
+
+// Beat event -> predictor, -1 if not used
+int got_beat (struct wire_msg *m)
 {
-  if (g >= 32)
-    GPIO_CLR_EXT = (1 << (g % 32));
-  else
-    GPIO_CLR = (1 << g);
+  int64_t err;
+  int r;
+
+  r = pll_beat (&pll, m->beat_ns, (int64_t)m->ibi_us * 1000, m->mbpm ? 60000000000000LL / m->mbpm : 0);
+  if (r < 0)
+    return r;
+
+  err = pll.err;
+  if (r == 0)
+    hist_add (&telem->predict, err < 0 ? -err : err);
+  __atomic_store_n (&telem->pll_beats, pll.beats, __ATOMIC_RELAXED);
+  __atomic_store_n (&telem->pll_resets, pll.resets, __ATOMIC_RELAXED);
+  __atomic_store_n (&telem->pll_err, err, __ATOMIC_RELAXED);
+  __atomic_store_n (&telem->pll_cycle, pll.cycle, __ATOMIC_RELAXED);
+
+  return 0;
 }
 
-//
-// Set up a memory regions to access GPIO
-//
-void setup_io()
+// MQTT message (mosquitto loop thread): ASCII or binary bpm, or a
+// beat event for the predictor (-P)
+void got_bpm (const char *payload, int len)
 {
-  /* open /dev/mem */
-  if ((mem_fd = open("/dev/mem", O_RDWR|O_SYNC) ) < 0) {
-    printf("can't open /dev/mem \n");
-    exit(-1);
+  struct wire_msg m;
+  uint64_t skipped = wire_rx.skipped, old = wire_rx.old, stale = wire_rx.stale, p;
+  int r, event;
+
+  r = wire_decode (payload, len, &m);
+  event = sync_slew && (m.flags & WIRE_F_EVENT);
+  if (r < 0 || (!event && (m.mbpm < MIN_BPM * 1000 || m.mbpm > MAX_BPM * 1000))) {
+    if (!quiet)
+      printf ("Ignoring bpm message (%d bytes)\n", len);
+    return;
   }
 
-  /* mmap GPIO */
-  gpio_map = (char *)mmap(
-			  NULL,             //Any adddress in our space will do
-			  BLOCK_SIZE,       //Map length
-			  PROT_READ|PROT_WRITE,// Enable reading & writting to mapped memory
-			  MAP_SHARED,       //Shared with other processes
-			  mem_fd,           //File to map
-			  GPIO_BASE         //Offset to GPIO peripheral
-			  );
+  if (!(m.flags & WIRE_F_ASCII)) {
+    r = wire_rx_check (&wire_rx, &m, max_age);
+    __atomic_add_fetch (&telem->wire_rx, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch (&telem->wire_skipped, wire_rx.skipped - skipped, __ATOMIC_RELAXED);
+    __atomic_add_fetch (&telem->wire_old, wire_rx.old - old, __ATOMIC_RELAXED);
+    __atomic_add_fetch (&telem->wire_stale, wire_rx.stale - stale, __ATOMIC_RELAXED);
+    if (r != WIRE_RX_OK)
+      return;
+  }
 
-  close(mem_fd); //No need to keep mem_fd open after mmap
+  if (event) {
+    if (got_beat (&m) < 0)
+      return;
+    p = pll_cycle (&pll) / 2;
+  }
+  else
+    p = MBPM_TO_PERIOD (m.mbpm);
 
-  if (gpio_map == MAP_FAILED) {
-    printf("mmap error %d\n", (int)gpio_map);
-    exit(-1);
+  if (!PERIOD_VALID (p)) {
+    if (!quiet)
+      printf ("Ignoring period %llu ns\n", (unsigned long long)p);
+    return;
   }
 
-  // Always use volatile pointer!
-  gpio = (volatile unsigned *)gpio_map;
+  __atomic_store_n (&new_sent, m.real_ns, __ATOMIC_RELAXED);
+  __atomic_store_n (&new_epoch, event ? pll.epoch : (m.flags & WIRE_F_BEAT) ? m.beat_ns : 0, __ATOMIC_RELAXED);
+  set_period (p);
 }
-
 #endif
 
-void got_sigint (int sig) 
+// Arm the timer on the next edge (sched_clock, ns, one shot). On
+// CLOCK_REALTIME, read() fails with ECANCELED if the clock is set.
+void timer_arm (int64_t edge)
 {
-  printf ("Got SIGINT\n");
+  struct itimerspec its;
+  int flags = TFD_TIMER_ABSTIME;
 
-  if (timer_delete (my_timer) < 0) {
-    perror ("timer_delete");
+  memset (&its, 0, sizeof(its));
+  its.it_value.tv_sec = edge / 1000000000;
+  its.it_value.tv_nsec = edge % 1000000000;
+
+  if (sched_clock == CLOCK_REALTIME)
+    flags |= TFD_TIMER_CANCEL_ON_SET;
+  if (timerfd_settime (timer_fd, flags, &its, NULL) < 0) {
+    perror ("timerfd_settime");
     exit (1);
   }
+}
+
+// Final report (stdout + -o file, CSV or JSON from the extension)
+void report (void)
+{
+  struct hist snap;
+  FILE *f;
 
-  exit (0);
+  hist_snapshot (jitter_hist, &snap);
+
+  printf ("Jitter (ns) ");
+  hist_print (stdout, &snap, HIST_FMT_TEXT);
+
+  if (hist_file) {
+    if ((f = fopen (hist_file, "w")) == NULL) {
+      perror (hist_file);
+      return;
+    }
+    hist_print (f, &snap, hist_fmt (hist_file));
+    fclose (f);
+  }
 }
 
-void got_sigalrm (int sig)
+// Phase sync (-P): once per beat of each output following -p, move
+// the next beat towards the reference grid (after the register writes)
+int64_t epoch = 0, ref_cycle = 0;   /* reference grid, 0 -> none */
+int locked[PULSE_MAX];              /* 0 -> the next correction is a step */
+int64_t beat_seen[PULSE_MAX];       /* last beat start aligned */
+
+void align (void)
 {
-  struct timespec tr;
-  time_t jitter; 
-  static time_t jitter_max = 0, jitter_avg = 0;
-
-  told = t;
-  clock_gettime (CLOCK_REALTIME, &tr);
-  t = (tr.tv_sec * 1000000000) + tr.tv_nsec;    
-#ifndef __x86_64__
-  if (test_loops % 2)
-    gpio_set (gpio_nr);
-  else
-    gpio_clr (gpio_nr);
-#endif
-  // Calculate jitter + display
-  jitter = abs(t - told - period);
-  jitter_avg += jitter;
-  if (test_loops && (jitter > jitter_max))
-    jitter_max = jitter;
-  
-  if (test_loops && !(test_loops % loop_prt)) {
-    jitter_avg /= loop_prt;
-    if (!quiet)
-      printf ("Loop= %d sec= %ld nsec= %ld delta= %ld ns jitter cur= %ld ns avg= %ld ns max= %ld ns\n", test_loops,  tr.tv_sec, tr.tv_nsec, t-told, jitter, jitter_avg, jitter_max);
-    jitter_avg = 0;
+  struct pulse_ch *pc;
+  int64_t err;
+  int i;
+
+  for (i = 0 ; i < pulse.n ; i++) {
+    pc = &pulse.ch[i];
+    if (!pc->follow || pc->cycle != ref_cycle || pc->new_cycle || pc->start == beat_seen[i])
+      continue;
+    beat_seen[i] = pc->start;
+
+    err = pulse_align (pc, epoch, locked[i] ? pc->cycle * sync_slew / 100 : 0);
+    if (locked[i])
+      hist_add (&telem->align, err < 0 ? -err : err);
+
+    telem_begin (telem);
+    telem->align_err = err;
+    if (!locked[i])
+      telem->align_steps++;
+    telem_end (telem);
+
+    if (!locked[i] && !quiet)
+      printf ("Phase step GPIO %d: %lld ns\n", pc->gpio, (long long)err);
+    locked[i] = 1;
+  }
+}
 
-    if (++ntest == ntest_max) {
-      if (timer_delete (my_timer) < 0) {
-	perror ("timer_delete");
-	exit (1);
-      }
+// DMA backend (-D): build the chain of the current period, then only
+// wake up on a new one. All the outputs share it.
+int dma_run (void)
+{
+  int64_t cycles[6];
+  uint64_t p;
+  uint64_t ev;
+  int i, n = 0, r = 0;
+  static int bpm[] = { 30, 60, 72, 120, 200 };
+
+  if (sync_slew)
+    fprintf (stderr, "-D: no phase sync, -P ignored\n");
+
+  for (i = 1 ; i < pulse.n ; i++) {
+    if (pulse.ch[i].cycle != pulse.ch[0].cycle) {
+      fprintf (stderr, "-D: all the outputs need the same period\n");
+      return 1;
+    }
+  }
+  pulse_start (&pulse, 0);   /* waveform tables */
+
+  if (dma_open (dma_sim ? DMA_SIM : DMA_HW, dma_chan) < 0)
+    return 1;
+
+  if (dma_sim) {
+    cycles[n++] = pulse.ch[0].cycle;
+    for (i = 0 ; i < 5 ; i++)
+      cycles[n++] = 2 * BPM_TO_PERIOD (bpm[i]);
+    r = dma_sim_verify (&pulse, cycles, n, !quiet);
+    printf ("dma sim: %s\n", r ? "FAILED" : "OK");
+    dma_close ();
+    return r != 0;
+  }
+
+  if (dma_load (&pulse, pulse.ch[0].cycle) < 0)
+    return 1;
+
+  while (!stop) {
+    if (read (period_fd, &ev, sizeof(ev)) != sizeof(ev)) {
+      if (errno == EINTR)
+	continue;
+      perror ("read / eventfd");
+      break;
+    }
+    if ((p = __atomic_exchange_n (&new_period, 0, __ATOMIC_ACQUIRE)) == 0)
+      continue;
 
-      printf ("Normal exiting.\n");
-      exit (0);
+    for (i = 0 ; i < pulse.n ; i++)
+      if (pulse_set_cycle (&pulse.ch[i], 2 * p) < 0)
+	break;
+    if (i < pulse.n) {
+      fprintf (stderr, "Period %llu ns not applied\n", (unsigned long long)p);
+      while (i--)
+	pulse_set_cycle (&pulse.ch[i], pulse.ch[i].cycle);
+      pulse_apply (&pulse);
+      continue;
     }
+    pulse_apply (&pulse);
+
+    // switched at the end of the running beat, wait if it is the
+    // previous chain (two periods within one beat)
+    while ((r = dma_load (&pulse, 2 * p)) == 1 && !stop)
+      usleep (DMA_RETRY_US);
+    if (r < 0)
+      break;
+    period = p;
+
+    telem_begin (telem);
+    telem->period = period;
+    for (i = 0 ; i < pulse.n && i < TELEM_CHANNELS ; i++)
+      telem->ch[i].bpm = 60000000000LL / pulse.ch[i].cycle;
+    telem_end (telem);
   }
 
-  test_loops++;
+  dma_close ();
+  for (i = 0 ; i < pulse.n ; i++)
+    bcm_gpio_clr (pulse.ch[i].gpio);
+
+  return r < 0;
 }
 
 void usage (char *s)
 {
-  fprintf (stderr, "Usage: %s [-p period (ns)] [-g gpio#] [-m] [-n loops] [-q]\n", s);
+  fprintf (stderr, "Usage: %s [-p period (ns)] [-g gpio#[:period-ns[:duty%%[:phase-ns]]] ...] [-m] [-r fifo-prio] [-a cpu] [-n loops] [-o hist.{txt,csv,json}] [-c ctrl-fifo] [-h mqtt_host -T mqtt_topic [-A max-age-ms]] [-s square|lubdub] [-P slew-%%] [-D dma-chan|sim] [-F] [-q]\n", s);
   exit (1);
 }
 
 int main(int ac, char **av)
 {
   char *cp, *progname = (char*)basename(av[0]);
-  struct itimerspec its, its_old;
+  struct sigaction sa;
+  struct timespec tr;
+  uint64_t ticks, missed;
+  int64_t sent = 0, lat;
+  struct pulse_ch *pc;
+  int i;
 
-  signal (SIGALRM, got_sigalrm);
-  signal (SIGINT, got_sigint);
+  // no SA_RESTART: SIGINT/SIGTERM interrupt read() on the timerfd
+  memset (&sa, 0, sizeof(sa));
+  sa.sa_handler = got_sigint;
+  sigaction (SIGINT, &sa, NULL);
+  sigaction (SIGTERM, &sa, NULL);
 
   while (--ac) {
     if ((cp = *++av) == NULL)
@@ -184,21 +456,71 @@ int main(int ac, char **av)
     if (*cp == '-' && *++cp) {
       switch(*cp) {
       case 'g' :
-	gpio_nr = atoi(*++av);
+	if (pulse_parse (&pulse, *++av) < 0)
+	  usage(progname);
 	break;
 
       case 'p' :
-	period = (unsigned long)atoi(*++av); break;
+	period = strtoull(*++av, NULL, 0); break;
 
       case 'm' :
 	ml = 1; break;
 
+      case 'r' :
+	rt_prio = atoi(*++av); break;
+
+      case 'a' :
+	rt_cpu = atoi(*++av); break;
+
       case 'n' :
 	ntest_max = (unsigned long)atoi(*++av); break;
 
+      case 'o' :
+	hist_file = *++av; break;
+
+      case 'c' :
+	ctrl_fifo = *++av; break;
+
+#ifdef USE_MOSQUITTO
+      case 'h' :
+	mqtt_host = *++av; break;
+
+      case 'T' :
+	mqtt_topic = *++av; break;
+
+      case 'A' :
+	max_age = atoll(*++av) * 1000000; break;
+#endif
+
+      case 'F' :
+	gpio_backend = BCM_GPIO_FAKE; break;
+
+      case 'P' :
+	sync_slew = atoi(*++av);
+	if (sync_slew < 0 || sync_slew > 25)
+	  usage(progname);
+	if (sync_slew)
+	  sched_clock = CLOCK_REALTIME;
+	break;
+
+      case 'D' :
+	if (strcmp (*++av, "sim") == 0) {
+	  dma_sim = 1;
+	  dma_chan = DMA_CHANNEL_DEFAULT;
+	  gpio_backend = BCM_GPIO_FAKE;
+	}
+	else
+	  dma_chan = atoi(*av);
+	break;
+
       case 'q' :
 	quiet = 1; break;
 
+      case 's' :
+	if ((shape = wave_shape (*++av)) < 0)
+	  usage(progname);
+	break;
+
       default: 
 	usage(progname);
 	break;
@@ -208,41 +530,168 @@ int main(int ac, char **av)
       break;
   }
 
-  if (ml) {
-    if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0)
-      perror ("mlockall");
-    else
-      printf ("mlockall: OK !\n");
+  if (!period)
+    usage(progname);
+
+  if (!pulse.n)
+    pulse_add (&pulse, gpio_nr, 0, 50, 0)->follow = 1;
+
+  // telemetry segment (before mlockall, its pages get locked too)
+  telem = telem_open ("rpi_gpio", pulse.n);
+  jitter_hist = &telem->jitter;
+  telem_begin (telem);
+  telem->period = period;
+  for (i = 0 ; i < pulse.n ; i++) {
+    pc = &pulse.ch[i];
+    if (pc->follow)
+      pc->cycle = 2 * period;
+    pc->shape = shape;
+    printf ("Using GPIO %d and period %lld ns (duty %d%%, phase %lld ns%s)\n", pc->gpio,
+	    (long long)pc->cycle / 2, pc->duty, (long long)pc->phase, shape ? ", lub-dub" : "");
+    if (i < TELEM_CHANNELS) {
+      telem->ch[i].gpio_out = pc->gpio;
+      telem->ch[i].bpm = 60000000000LL / pc->cycle;
+    }
   }
+  telem_end (telem);
+  // mmap()ed GPIO registers (/dev/gpiomem, /dev/mem or fake with -F)
+  if (bcm_gpio_open (gpio_backend) < 0)
+    exit (1);
 
-  // Display every 2 sec
-  loop_prt = 2000000000 / period;
-  
-  printf ("Using GPIO %d and period %ld ns\n", gpio_nr, period);
-#ifndef __x86_64__
-  // Set up io pointer for direct register access
-  setup_io();
+  // Set GPIOs as output
+  for (i = 0 ; i < pulse.n ; i++)
+    bcm_gpio_out (pulse.ch[i].gpio);
 
-  // Set GPIO  as output
-  OUT_GPIO(gpio_nr);
-#endif
-  if (timer_create (CLOCK_REALTIME, NULL, &my_timer) < 0) {
-    perror ("timer_create");
+  if (dma_sim)
+    exit (dma_run ());
+
+  if (dma_chan >= 0 && (period_fd = eventfd (0, EFD_CLOEXEC)) < 0) {
+    perror ("eventfd");
+    exit (1);
+  }
+
+  // not inheriting the RT setup below (no jitter to report with -D)
+  if (dma_chan < 0 && pthread_create (&reporter_thread, NULL, reporter, NULL) != 0) {
+    perror ("pthread_create");
     exit (1);
   }
 
-  its.it_value.tv_sec = 0;
-  its.it_value.tv_nsec = 1;
-  its.it_interval.tv_sec = 0;
-  its.it_interval.tv_nsec = period;
+  if (ctrl_fifo) {
+    if (mkfifo (ctrl_fifo, 0666) < 0 && errno != EEXIST) {
+      perror (ctrl_fifo);
+      exit (1);
+    }
+    if (pthread_create (&control_thread, NULL, control, NULL) != 0) {
+      perror ("pthread_create");
+      exit (1);
+    }
+  }
+
+#ifdef USE_MOSQUITTO
+  // persistent subscription, loop thread started before the RT setup
+  mqtt_subscribe (got_bpm);
+  mqtt_setup ();
+#endif
+
+  if (dma_chan >= 0)
+    exit (dma_run ());
 
-  if (timer_settime (my_timer, 0, &its, &its_old) < 0) {
-    perror ("timer_settime");
+  // RT setup before the first period (mlockall + prefault, SCHED_FIFO, CPU)
+  if (rt_setup (ml, rt_prio, rt_cpu) == 0 && (ml || rt_prio || rt_cpu >= 0))
+    printf ("RT setup: OK (mlock= %d prio= %d cpu= %d) !\n", ml, rt_prio, rt_cpu);
+  rt_prefault (bcm_gpio, BCM_GPIO_SIZE);
+  if ((timer_fd = timerfd_create (sched_clock, TFD_CLOEXEC)) < 0) {
+    perror ("timerfd_create");
     exit (1);
   }
 
-  while (1)
-    pause();
+  // first rising edges now (+ phase), then every cycle
+  clock_gettime (sched_clock, &tr);
+  pulse_start (&pulse, ((int64_t)tr.tv_sec * 1000000000) + tr.tv_nsec);
+  timer_arm (pulse_next (&pulse));
+
+  while (!stop) {
+    // one shot timer on the earliest edge
+    if (read (timer_fd, &ticks, sizeof(ticks)) != sizeof(ticks)) {
+      if (errno == EINTR)
+	continue;
+      if (errno == ECANCELED) {
+	// clock set (-P): the deadlines are off, restart the outputs now
+	// and step them onto the grid again
+	clock_gettime (sched_clock, &tr);
+	pulse_start (&pulse, ((int64_t)tr.tv_sec * 1000000000) + tr.tv_nsec);
+	memset (locked, 0, sizeof(locked));
+	timer_arm (pulse_next (&pulse));
+	continue;
+      }
+      perror ("read / timerfd");
+      exit (1);
+    }
+
+    clock_gettime (sched_clock, &tr);
+    t = ((int64_t)tr.tv_sec * 1000000000) + tr.tv_nsec;
+
+    // all the edges due now, one store per bank
+    lat = t - pulse_next (&pulse);
+    test_loops += pulse_run (&pulse, t, &missed) + missed;
+    pulse_write (&pulse);
+
+    sample (lat, missed);
+
+    // MQTT binary message: sender -> first edge at the new period
+    if (sent && pulse.changed) {
+      lat = wire_realtime () - sent + (pulse.changed - t);
+      if (lat >= 0)
+	hist_add (&telem->latency, lat);
+      else
+	hist_missed (&telem->latency, 1);   /* clocks not in sync */
+      sent = 0;
+    }
+
+    // new period from -c / MQTT: applied from the next edge (next beat
+    // with a waveform) of each output that follows -p. Tables are built
+    // here, after the register writes, and only for a new bpm.
+    if (__atomic_load_n (&new_period, __ATOMIC_RELAXED)) {
+      period = __atomic_exchange_n (&new_period, 0, __ATOMIC_ACQUIRE);
+      sent = __atomic_exchange_n (&new_sent, 0, __ATOMIC_RELAXED);
+      for (i = 0 ; i < pulse.n ; i++)
+	if (pulse.ch[i].follow && pulse_set_cycle (&pulse.ch[i], 2 * period) < 0)
+	  fprintf (stderr, "GPIO %d: period %llu ns not applied\n", pulse.ch[i].gpio, (unsigned long long)period);
+
+      // a period without a reference beat: free running. The running
+      // beats started at the previous cycle: align from the next ones.
+      if ((epoch = __atomic_exchange_n (&new_epoch, 0, __ATOMIC_RELAXED)) == 0)
+	memset (locked, 0, sizeof(locked));
+      ref_cycle = 2 * period;
+      for (i = 0 ; i < pulse.n ; i++)
+	beat_seen[i] = pulse.ch[i].start;
+    }
+
+    if (sync_slew && epoch)
+      align ();
+
+    telem_begin (telem);
+    telem->period = period;
+    for (i = 0 ; i < pulse.n && i < TELEM_CHANNELS ; i++) {
+      telem->ch[i].edges = pulse.ch[i].edges + pulse.ch[i].missed;
+      telem->ch[i].bpm = 60000000000LL / pulse.ch[i].cycle;
+    }
+    telem_end (telem);
+
+    timer_arm (pulse_next (&pulse));
+  }
+
+  close (timer_fd);
+
+  pthread_cancel (reporter_thread);
+  pthread_join (reporter_thread, NULL);
+
+  report ();
+
+  if (ntest_max && ntest == ntest_max)
+    printf ("Normal exiting.\n");
+  else
+    printf ("Got SIGINT\n");
 
   return 0;
 
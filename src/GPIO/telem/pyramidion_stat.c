@@ -0,0 +1,216 @@
+//
+// pyramidion_stat: display the telemetry segments of gpioIrq,
+// gpioIrq_th and rpi_gpio (/dev/shm/pyramidion-*), live or as JSON.
+//
+//   pyramidion_stat             all segments, refreshed every second
+//   pyramidion_stat -j          one JSON dump
+//   pyramidion_stat rpi_gpio    only this one (name or path)
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <glob.h>
+#include <time.h>
+
+#include "telem.h"
+
+int json = 0;
+int once = 0;
+int interval = 1;   /* sec */
+
+void usage (char *s)
+{
+  fprintf (stderr, "Usage: %s [-j] [-1] [-i sec] [prog|segment ...]\n", s);
+  exit (1);
+}
+
+int64_t now (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int alive (struct telem *t)
+{
+  return kill (t->pid, 0) == 0;
+}
+
+void print_text (struct telem *t)
+{
+  struct telem_channel *c;
+  unsigned int i;
+
+  printf ("%s pid= %d%s up= %llds", t->prog, t->pid, alive (t) ? "" : " (dead)",
+	  (long long)((now () - t->start) / 1000000000));
+  if (t->period)
+    printf (" period= %llu ns", (unsigned long long)t->period);
+  printf (" mqtt_errors= %llu\n", (unsigned long long)t->mqtt_errors);
+
+  for (i = 0 ; i < t->nchannels ; i++) {
+    c = &t->ch[i];
+    printf ("  ch%u %u->%u bpm= %llu edges= %llu dropped= %llu timeouts= %llu\n", i, c->gpio_in, c->gpio_out,
+	    (unsigned long long)c->bpm, (unsigned long long)c->edges,
+	    (unsigned long long)c->dropped, (unsigned long long)c->timeouts);
+  }
+
+  if (t->jitter.samples) {
+    printf ("  jitter (ns) ");
+    hist_print (stdout, &t->jitter, HIST_FMT_TEXT);
+  }
+
+  if (t->wire_rx) {
+    printf ("  wire rx= %llu skipped= %llu old= %llu stale= %llu\n",
+	    (unsigned long long)t->wire_rx, (unsigned long long)t->wire_skipped,
+	    (unsigned long long)t->wire_old, (unsigned long long)t->wire_stale);
+  }
+
+  if (t->latency.samples) {
+    printf ("  latency (ns) ");
+    hist_print (stdout, &t->latency, HIST_FMT_TEXT);
+  }
+
+  if (t->align.samples || t->align_steps) {
+    printf ("  align err= %lld ns steps= %llu (ns) ", (long long)t->align_err, (unsigned long long)t->align_steps);
+    hist_print (stdout, &t->align, HIST_FMT_TEXT);
+  }
+
+  if (t->pll_beats) {
+    printf ("  predict beats= %llu resets= %llu cycle= %lld ns err= %lld ns (ns) ", (unsigned long long)t->pll_beats,
+	    (unsigned long long)t->pll_resets, (long long)t->pll_cycle, (long long)t->pll_err);
+    hist_print (stdout, &t->predict, HIST_FMT_TEXT);
+  }
+}
+
+void print_json (struct telem *t, int first)
+{
+  struct telem_channel *c;
+  unsigned int i;
+
+  printf ("%s  {\"prog\": \"%s\", \"pid\": %d, \"alive\": %d, \"uptime_ns\": %lld, \"period_ns\": %llu, \"mqtt_errors\": %llu,\n",
+	  first ? "" : ",\n", t->prog, t->pid, alive (t), (long long)(now () - t->start),
+	  (unsigned long long)t->period, (unsigned long long)t->mqtt_errors);
+
+  printf ("   \"channels\": [");
+  for (i = 0 ; i < t->nchannels ; i++) {
+    c = &t->ch[i];
+    printf ("%s{\"gpio_in\": %u, \"gpio_out\": %u, \"bpm\": %llu, \"edges\": %llu, \"dropped\": %llu, \"timeouts\": %llu}",
+	    i ? ", " : "", c->gpio_in, c->gpio_out, (unsigned long long)c->bpm, (unsigned long long)c->edges,
+	    (unsigned long long)c->dropped, (unsigned long long)c->timeouts);
+  }
+  printf ("],\n");
+
+  printf ("   \"jitter_ns\": {\"samples\": %llu, \"missed\": %llu, \"p50\": %llu, \"p99\": %llu, \"p999\": %llu, \"max\": %llu}",
+	  (unsigned long long)t->jitter.samples, (unsigned long long)t->jitter.missed,
+	  (unsigned long long)hist_percentile (&t->jitter, 50),
+	  (unsigned long long)hist_percentile (&t->jitter, 99),
+	  (unsigned long long)hist_percentile (&t->jitter, 99.9),
+	  (unsigned long long)t->jitter.max);
+
+  printf (",\n   \"wire\": {\"rx\": %llu, \"skipped\": %llu, \"old\": %llu, \"stale\": %llu},\n",
+	  (unsigned long long)t->wire_rx, (unsigned long long)t->wire_skipped,
+	  (unsigned long long)t->wire_old, (unsigned long long)t->wire_stale);
+
+  printf ("   \"latency_ns\": {\"samples\": %llu, \"missed\": %llu, \"p50\": %llu, \"p99\": %llu, \"p999\": %llu, \"max\": %llu},\n",
+	  (unsigned long long)t->latency.samples, (unsigned long long)t->latency.missed,
+	  (unsigned long long)hist_percentile (&t->latency, 50),
+	  (unsigned long long)hist_percentile (&t->latency, 99),
+	  (unsigned long long)hist_percentile (&t->latency, 99.9),
+	  (unsigned long long)t->latency.max);
+
+  printf ("   \"align_ns\": {\"last\": %lld, \"steps\": %llu, \"samples\": %llu, \"p50\": %llu, \"p99\": %llu, \"p999\": %llu, \"max\": %llu},\n",
+	  (long long)t->align_err, (unsigned long long)t->align_steps, (unsigned long long)t->align.samples,
+	  (unsigned long long)hist_percentile (&t->align, 50),
+	  (unsigned long long)hist_percentile (&t->align, 99),
+	  (unsigned long long)hist_percentile (&t->align, 99.9),
+	  (unsigned long long)t->align.max);
+
+  printf ("   \"predict_ns\": {\"beats\": %llu, \"resets\": %llu, \"cycle\": %lld, \"last\": %lld, \"samples\": %llu, \"p50\": %llu, \"p99\": %llu, \"p999\": %llu, \"max\": %llu}}",
+	  (unsigned long long)t->pll_beats, (unsigned long long)t->pll_resets, (long long)t->pll_cycle,
+	  (long long)t->pll_err, (unsigned long long)t->predict.samples,
+	  (unsigned long long)hist_percentile (&t->predict, 50),
+	  (unsigned long long)hist_percentile (&t->predict, 99),
+	  (unsigned long long)hist_percentile (&t->predict, 99.9),
+	  (unsigned long long)t->predict.max);
+}
+
+int main (int ac, char **av)
+{
+  glob_t g;
+  struct telem t;
+  char path[256];
+  char *cp, *progname = av[0];
+  int i, n;
+
+  memset (&g, 0, sizeof(g));
+
+  while (--ac) {
+    if ((cp = *++av) == NULL)
+      break;
+    if (*cp == '-' && *++cp) {
+      switch(*cp) {
+      case 'j' :
+	json = once = 1; break;
+
+      case '1' :
+	once = 1; break;
+
+      case 'i' :
+	interval = atoi(*++av); break;
+
+      default: 
+	usage(progname);
+	break;
+      }
+    }
+    else {
+      // segment name (gpioIrq, rpi_gpio...) or path
+      if (strchr (cp, '/'))
+	snprintf (path, sizeof(path), "%s", cp);
+      else
+	snprintf (path, sizeof(path), TELEM_DIR "/" TELEM_PREFIX "%s", cp);
+      glob (path, g.gl_pathc ? GLOB_APPEND | GLOB_NOCHECK : GLOB_NOCHECK, NULL, &g);
+    }
+  }
+
+  if (!g.gl_pathc)
+    glob (TELEM_DIR "/" TELEM_PREFIX "*", 0, NULL, &g);
+
+  while (1) {
+    if (json)
+      printf ("[\n");
+    else if (!once)
+      printf ("\033[H\033[J");
+
+    for (i = n = 0 ; i < (int)g.gl_pathc ; i++) {
+      if (telem_read (g.gl_pathv[i], &t) < 0) {
+	if (!json)
+	  printf ("%s: no valid segment\n", g.gl_pathv[i]);
+	continue;
+      }
+
+      if (json)
+	print_json (&t, n == 0);
+      else
+	print_text (&t);
+      n++;
+    }
+
+    if (json)
+      printf ("\n]\n");
+
+    if (once)
+      break;
+
+    fflush (stdout);
+    sleep (interval);
+  }
+
+  globfree (&g);
+
+  return 0;
+}